@@ -0,0 +1,174 @@
+#pragma once
+
+#include "../intrusive/intrusive.h"
+#include "../unique/unique.h"
+
+#include <algorithm>  // std::max
+#include <cstddef>    // std::max_align_t
+#include <cstdint>    // std::uintptr_t
+#include <cstdlib>    // std::malloc, std::free
+#include <new>        // std::bad_alloc
+#include <type_traits>
+#include <utility>
+
+inline constexpr size_t kArenaDefaultBlockSize = 64 * 1024;
+
+// Monotonic arena: allocation is a pointer bump, nothing is freed individually and all memory
+// goes back in bulk on `Reset()` or destruction. Objects placed in it are expected to be
+// destroyed (via `ArenaDeleter`/`ArenaDelete`) before that happens.
+class Arena {
+public:
+    explicit Arena(size_t block_size = kArenaDefaultBlockSize);
+    Arena(const Arena& other) = delete;
+    Arena& operator=(const Arena& other) = delete;
+    ~Arena();
+
+    void* Allocate(size_t size, size_t align = alignof(std::max_align_t));
+
+    template <typename T, typename... Args>
+    T* Create(Args&&... args);
+
+    // Frees every block except the first one, which is kept for the next round
+    void Reset();
+
+    size_t BytesAllocated() const;
+
+private:
+    struct Block {
+        Block* next;
+        size_t size;
+    };
+
+    void AddBlock(size_t min_size);
+    static char* Data(Block* block);
+
+    size_t block_size_;
+    Block* head_;
+    char* current_;
+    char* end_;
+    size_t bytes_allocated_;
+};
+inline Arena::Arena(size_t block_size)
+    : block_size_(block_size),
+      head_(nullptr),
+      current_(nullptr),
+      end_(nullptr),
+      bytes_allocated_(0) {
+}
+inline Arena::~Arena() {
+    while (head_) {
+        Block* next = head_->next;
+        std::free(head_);
+        head_ = next;
+    }
+}
+inline char* Arena::Data(Block* block) {
+    return reinterpret_cast<char*>(block) + sizeof(Block);
+}
+inline void Arena::AddBlock(size_t min_size) {
+    size_t size = std::max(block_size_, min_size);
+    auto block = static_cast<Block*>(std::malloc(sizeof(Block) + size));
+    if (!block) {
+        throw std::bad_alloc();
+    }
+    block->next = head_;
+    block->size = size;
+    head_ = block;
+    current_ = Data(block);
+    end_ = current_ + size;
+}
+inline void* Arena::Allocate(size_t size, size_t align) {
+    auto aligned = [&] {
+        auto address = reinterpret_cast<std::uintptr_t>(current_);
+        return reinterpret_cast<char*>((address + align - 1) & ~(align - 1));
+    };
+    char* result = aligned();
+    if (!current_ || result + size > end_) {
+        AddBlock(size + align);
+        result = aligned();
+    }
+    current_ = result + size;
+    bytes_allocated_ += size;
+    return result;
+}
+template <typename T, typename... Args>
+T* Arena::Create(Args&&... args) {
+    return new (Allocate(sizeof(T), alignof(T))) T{std::forward<Args>(args)...};
+}
+inline void Arena::Reset() {
+    if (!head_) {
+        return;
+    }
+    // Blocks are prepended, so the first one allocated is at the tail
+    Block* first = head_;
+    while (first->next) {
+        Block* next = first->next;
+        std::free(first);
+        first = next;
+    }
+    head_ = first;
+    current_ = Data(first);
+    end_ = current_ + first->size;
+    bytes_allocated_ = 0;
+}
+inline size_t Arena::BytesAllocated() const {
+    return bytes_allocated_;
+}
+
+////////////////////////////////////////////////////////////
+
+// Deleter for `UniquePtr` over arena memory: runs the destructor (nothing at all for trivially
+// destructible types) and leaves the memory to the arena. Stateless, so `CompressedPair` keeps
+// `UniquePtr<T, ArenaDeleter<T>>` pointer-sized.
+template <typename T>
+struct ArenaDeleter {
+    ArenaDeleter() = default;
+    template <typename U>
+    ArenaDeleter(const ArenaDeleter<U>& other) {
+    }
+    void operator()(T* ptr) const {
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            ptr->~T();
+        }
+    }
+};
+template <typename T>
+struct ArenaDeleter<T[]> {
+    // The array length is not known here, so there is no way to run element destructors
+    static_assert(std::is_trivially_destructible_v<T>,
+                  "Arena arrays are only supported for trivially destructible types");
+    ArenaDeleter() = default;
+    template <typename U>
+    ArenaDeleter(const ArenaDeleter<U>& other) {
+    }
+    void operator()(T* ptr) const {
+    }
+};
+
+// `Deleter` policy for `RefCounted` objects created in an arena
+struct ArenaDelete {
+    template <typename T>
+    static void Destroy(T* object) {
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            object->~T();
+        }
+    }
+};
+
+template <typename Derived>
+using ArenaRefCounted = RefCounted<Derived, SimpleCounter, ArenaDelete>;
+
+template <typename T>
+using ArenaUniquePtr = UniquePtr<T, ArenaDeleter<T>>;
+
+static_assert(sizeof(ArenaUniquePtr<int>) == sizeof(int*));
+
+template <typename T, typename... Args>
+ArenaUniquePtr<T> MakeArenaUnique(Arena& arena, Args&&... args) {
+    return ArenaUniquePtr<T>(arena.Create<T>(std::forward<Args>(args)...));
+}
+
+template <typename T, typename... Args>
+IntrusivePtr<T> MakeArenaIntrusive(Arena& arena, Args&&... args) {
+    return IntrusivePtr<T>(arena.Create<T>(std::forward<Args>(args)...));
+}
@@ -0,0 +1,373 @@
+#pragma once
+
+#include "../intrusive/intrusive.h"
+
+#include <algorithm>  // std::min
+#include <cerrno>
+#include <cstddef>
+#include <cstring>  // std::memcpy
+#include <deque>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#include <sys/uio.h>  // readv, writev, iovec
+
+// Capacity of the segments a `BufferChain` allocates for copied and read bytes
+inline constexpr size_t kBufferSegmentSize = 16 * 1024;
+// `iovec`s passed to a single `readv`/`writev`, well below any `IOV_MAX`
+inline constexpr size_t kBufferChainMaxIovecs = 64;
+
+class BufferSegment;
+
+struct BufferSegmentDelete {
+    static void Destroy(BufferSegment* segment);
+};
+
+// Reference-counted block of bytes, header and data in one allocation. Bytes up to `Size()` are
+// written and may be shared by any number of chains; the room after them is only ever filled by
+// a chain holding the sole reference.
+class BufferSegment : public RefCounted<BufferSegment, SimpleCounter, BufferSegmentDelete> {
+public:
+    static IntrusivePtr<BufferSegment> Allocate(size_t capacity);
+
+    char* Data();
+    const char* Data() const;
+    size_t Capacity() const;
+    size_t Size() const;
+    size_t Room() const;
+    // Marks the next `size` bytes of the room as written
+    void Commit(size_t size);
+
+private:
+    friend struct BufferSegmentDelete;
+
+    explicit BufferSegment(size_t capacity);
+
+    size_t capacity_;
+    size_t size_;
+};
+inline void BufferSegmentDelete::Destroy(BufferSegment* segment) {
+    segment->~BufferSegment();
+    ::operator delete(segment);
+}
+inline BufferSegment::BufferSegment(size_t capacity) : capacity_(capacity), size_(0) {
+}
+inline IntrusivePtr<BufferSegment> BufferSegment::Allocate(size_t capacity) {
+    void* memory = ::operator new(sizeof(BufferSegment) + capacity);
+    return IntrusivePtr<BufferSegment>(new (memory) BufferSegment(capacity));
+}
+inline char* BufferSegment::Data() {
+    return reinterpret_cast<char*>(this + 1);
+}
+inline const char* BufferSegment::Data() const {
+    return reinterpret_cast<const char*>(this + 1);
+}
+inline size_t BufferSegment::Capacity() const {
+    return capacity_;
+}
+inline size_t BufferSegment::Size() const {
+    return size_;
+}
+inline size_t BufferSegment::Room() const {
+    return capacity_ - size_;
+}
+inline void BufferSegment::Commit(size_t size) {
+    size_ += size;
+}
+
+// A written range of a segment
+struct BufferFragment {
+    const char* Data() const {
+        return segment->Data() + offset;
+    }
+
+    IntrusivePtr<BufferSegment> segment;
+    size_t offset;
+    size_t length;
+};
+
+// Byte sequence made of fragments of shared segments: appending, prepending and slicing chains
+// shares segments instead of copying bytes, and the fragments go to the kernel as they are
+// through `writev` (or `sendmsg`, with `FillIovecs`). `ReadFrom` reads into fresh segments, or
+// the unshared room of the last one, with `readv`, so nothing is copied on the way in either.
+//
+// Segment counts are not atomic: a chain and the chains sharing its segments must stay on one
+// thread, or be handed over together.
+class BufferChain {
+public:
+    BufferChain();
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    // Copies the bytes, into the room of the last segment where this chain is its only user
+    void Append(const void* data, size_t size);
+    // Share `other`'s segments
+    void Append(BufferChain other);
+    void Prepend(BufferChain other);
+    void Append(IntrusivePtr<BufferSegment> segment, size_t offset, size_t length);
+    // Drop bytes from either end, e.g. what a `writev` has already sent. Throw
+    // `std::out_of_range` if there are fewer.
+    void TrimFront(size_t size);
+    void TrimBack(size_t size);
+    void Clear();
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // I/O
+
+    // Fills up to `max_count` entries with the first fragments and returns how many it filled
+    size_t FillIovecs(iovec* iov, size_t max_count) const;
+    // One `writev` of the front of the chain; the bytes written are trimmed off and returned.
+    // Zero if a non-blocking descriptor is full. Throws `std::system_error` on errors.
+    size_t WriteTo(int fd);
+    // Writes everything to a blocking descriptor
+    void WriteAll(int fd);
+    // One `readv` of up to `max_size` bytes appended to the chain. Returns the count, zero at end
+    // of file, or `std::nullopt` if a non-blocking descriptor has nothing yet. Throws
+    // `std::system_error` on errors and `std::invalid_argument` if `max_size` is zero, whose
+    // result would read as end of file.
+    std::optional<size_t> ReadFrom(int fd, size_t max_size = kBufferSegmentSize);
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    // Shares the segments covering `[offset, offset + length)`. Throws `std::out_of_range` if the
+    // range does not fit.
+    BufferChain Slice(size_t offset, size_t length) const;
+    // Copies the whole chain to `dest`, which must have room for `Size()` bytes
+    void CopyTo(void* dest) const;
+    // Calls `function(data, length)` for each fragment in order
+    template <typename Function>
+    void ForEachFragment(Function&& function) const;
+    size_t Size() const;
+    bool Empty() const;
+    size_t FragmentCount() const;
+
+private:
+    // The room after the last fragment, if no one else can see it
+    BufferSegment* WritableTail();
+
+    std::deque<BufferFragment> fragments_;
+    size_t size_;
+};
+inline BufferChain::BufferChain() : size_(0) {
+}
+inline BufferSegment* BufferChain::WritableTail() {
+    if (fragments_.empty()) {
+        return nullptr;
+    }
+    BufferFragment& last = fragments_.back();
+    BufferSegment* segment = last.segment.Get();
+    if (segment->RefCount() != 1 || last.offset + last.length != segment->Size() ||
+        segment->Room() == 0) {
+        return nullptr;
+    }
+    return segment;
+}
+inline void BufferChain::Append(const void* data, size_t size) {
+    auto bytes = static_cast<const char*>(data);
+    if (BufferSegment* tail = WritableTail()) {
+        size_t chunk = std::min(size, tail->Room());
+        std::memcpy(tail->Data() + tail->Size(), bytes, chunk);
+        tail->Commit(chunk);
+        fragments_.back().length += chunk;
+        size_ += chunk;
+        bytes += chunk;
+        size -= chunk;
+    }
+    while (size > 0) {
+        IntrusivePtr<BufferSegment> segment = BufferSegment::Allocate(kBufferSegmentSize);
+        size_t chunk = std::min(size, segment->Room());
+        std::memcpy(segment->Data(), bytes, chunk);
+        segment->Commit(chunk);
+        Append(std::move(segment), 0, chunk);
+        bytes += chunk;
+        size -= chunk;
+    }
+}
+inline void BufferChain::Append(BufferChain other) {
+    for (auto& fragment : other.fragments_) {
+        fragments_.push_back(std::move(fragment));
+    }
+    size_ += other.size_;
+    other.Clear();
+}
+inline void BufferChain::Prepend(BufferChain other) {
+    for (auto it = other.fragments_.rbegin(); it != other.fragments_.rend(); ++it) {
+        fragments_.push_front(std::move(*it));
+    }
+    size_ += other.size_;
+    other.Clear();
+}
+inline void BufferChain::Append(IntrusivePtr<BufferSegment> segment, size_t offset,
+                                size_t length) {
+    if (offset > segment->Size() || length > segment->Size() - offset) {
+        throw std::out_of_range("BufferChain: fragment past the written bytes");
+    }
+    if (length == 0) {
+        return;
+    }
+    fragments_.push_back(BufferFragment{std::move(segment), offset, length});
+    size_ += length;
+}
+inline void BufferChain::TrimFront(size_t size) {
+    if (size > size_) {
+        throw std::out_of_range("BufferChain: trimming more than the chain holds");
+    }
+    size_ -= size;
+    while (size > 0) {
+        BufferFragment& front = fragments_.front();
+        if (front.length > size) {
+            front.offset += size;
+            front.length -= size;
+            return;
+        }
+        size -= front.length;
+        fragments_.pop_front();
+    }
+}
+inline void BufferChain::TrimBack(size_t size) {
+    if (size > size_) {
+        throw std::out_of_range("BufferChain: trimming more than the chain holds");
+    }
+    size_ -= size;
+    while (size > 0) {
+        BufferFragment& back = fragments_.back();
+        if (back.length > size) {
+            back.length -= size;
+            return;
+        }
+        size -= back.length;
+        fragments_.pop_back();
+    }
+}
+inline void BufferChain::Clear() {
+    fragments_.clear();
+    size_ = 0;
+}
+inline size_t BufferChain::FillIovecs(iovec* iov, size_t max_count) const {
+    size_t count = std::min(max_count, fragments_.size());
+    for (size_t i = 0; i < count; ++i) {
+        iov[i].iov_base = const_cast<char*>(fragments_[i].Data());
+        iov[i].iov_len = fragments_[i].length;
+    }
+    return count;
+}
+inline size_t BufferChain::WriteTo(int fd) {
+    iovec iov[kBufferChainMaxIovecs];
+    size_t count = FillIovecs(iov, kBufferChainMaxIovecs);
+    if (count == 0) {
+        return 0;
+    }
+    ssize_t written;
+    do {
+        written = writev(fd, iov, static_cast<int>(count));
+    } while (written < 0 && errno == EINTR);
+    if (written < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        throw std::system_error(errno, std::generic_category(), "writev");
+    }
+    TrimFront(static_cast<size_t>(written));
+    return static_cast<size_t>(written);
+}
+inline void BufferChain::WriteAll(int fd) {
+    while (!Empty()) {
+        WriteTo(fd);
+    }
+}
+inline std::optional<size_t> BufferChain::ReadFrom(int fd, size_t max_size) {
+    if (max_size == 0) {
+        throw std::invalid_argument("BufferChain: reading zero bytes");
+    }
+    iovec iov[kBufferChainMaxIovecs];
+    size_t count = 0;
+    size_t planned = 0;
+    BufferSegment* tail = WritableTail();
+    if (tail) {
+        iov[count].iov_base = tail->Data() + tail->Size();
+        iov[count].iov_len = std::min(max_size, tail->Room());
+        planned += iov[count++].iov_len;
+    }
+    IntrusivePtr<BufferSegment> fresh[kBufferChainMaxIovecs];
+    size_t fresh_count = 0;
+    while (planned < max_size && count < kBufferChainMaxIovecs) {
+        fresh[fresh_count] = BufferSegment::Allocate(kBufferSegmentSize);
+        iov[count].iov_base = fresh[fresh_count++]->Data();
+        iov[count].iov_len = std::min(max_size - planned, kBufferSegmentSize);
+        planned += iov[count++].iov_len;
+    }
+    ssize_t result;
+    do {
+        result = readv(fd, iov, static_cast<int>(count));
+    } while (result < 0 && errno == EINTR);
+    if (result < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return std::nullopt;
+        }
+        throw std::system_error(errno, std::generic_category(), "readv");
+    }
+    auto left = static_cast<size_t>(result);
+    if (tail) {
+        size_t chunk = std::min(left, iov[0].iov_len);
+        tail->Commit(chunk);
+        fragments_.back().length += chunk;
+        size_ += chunk;
+        left -= chunk;
+    }
+    for (size_t i = 0; i < fresh_count && left > 0; ++i) {
+        size_t chunk = std::min(left, kBufferSegmentSize);
+        fresh[i]->Commit(chunk);
+        Append(std::move(fresh[i]), 0, chunk);
+        left -= chunk;
+    }
+    return static_cast<size_t>(result);
+}
+inline BufferChain BufferChain::Slice(size_t offset, size_t length) const {
+    if (offset > size_ || length > size_ - offset) {
+        throw std::out_of_range("BufferChain: slice past the end");
+    }
+    BufferChain result;
+    for (const auto& fragment : fragments_) {
+        if (length == 0) {
+            break;
+        }
+        if (offset >= fragment.length) {
+            offset -= fragment.length;
+            continue;
+        }
+        size_t chunk = std::min(length, fragment.length - offset);
+        result.fragments_.push_back(
+            BufferFragment{fragment.segment, fragment.offset + offset, chunk});
+        result.size_ += chunk;
+        length -= chunk;
+        offset = 0;
+    }
+    return result;
+}
+inline void BufferChain::CopyTo(void* dest) const {
+    auto out = static_cast<char*>(dest);
+    for (const auto& fragment : fragments_) {
+        std::memcpy(out, fragment.Data(), fragment.length);
+        out += fragment.length;
+    }
+}
+template <typename Function>
+void BufferChain::ForEachFragment(Function&& function) const {
+    for (const auto& fragment : fragments_) {
+        function(fragment.Data(), fragment.length);
+    }
+}
+inline size_t BufferChain::Size() const {
+    return size_;
+}
+inline bool BufferChain::Empty() const {
+    return size_ == 0;
+}
+inline size_t BufferChain::FragmentCount() const {
+    return fragments_.size();
+}
@@ -0,0 +1,127 @@
+// `BufferChain` through real descriptors: a non-blocking pipe with partial writes and reads, a
+// socketpair, and a file. Not part of any build; exits non-zero on the first failed check:
+//     g++ -std=c++17 -O1 -g buffer/test.cpp -o buffer-test && ./buffer-test
+
+#include "buffer_chain.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define CHECK(condition)                                                                    \
+    do {                                                                                    \
+        if (!(condition)) {                                                                 \
+            std::fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #condition);   \
+            std::exit(1);                                                                   \
+        }                                                                                   \
+    } while (false)
+
+namespace {
+
+std::string Contents(const BufferChain& chain) {
+    std::string contents(chain.Size(), '\0');
+    chain.CopyTo(contents.data());
+    return contents;
+}
+
+// More than a few segments, with no period dividing the segment size
+std::string Pattern(size_t size) {
+    std::string pattern(size, '\0');
+    for (size_t i = 0; i < size; ++i) {
+        pattern[i] = static_cast<char>('a' + i % 26);
+    }
+    return pattern;
+}
+
+BufferChain ChainOf(const std::string& bytes) {
+    BufferChain chain;
+    chain.Append(bytes.data(), bytes.size());
+    return chain;
+}
+
+// Both ends non-blocking, so writes are partial once the pipe fills up and reads run dry
+void TestPipe() {
+    std::string bytes = Pattern(200000);
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+    CHECK(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0);
+    CHECK(fcntl(fds[1], F_SETFL, O_NONBLOCK) == 0);
+
+    BufferChain out = ChainOf(bytes);
+    BufferChain in;
+    while (!out.Empty() || in.Size() < bytes.size()) {
+        out.WriteTo(fds[1]);
+        while (std::optional<size_t> read = in.ReadFrom(fds[0], 40000)) {
+            CHECK(*read > 0);
+        }
+    }
+    CHECK(Contents(in) == bytes);
+    CHECK(!in.ReadFrom(fds[0]).has_value());
+
+    close(fds[1]);
+    std::optional<size_t> end = in.ReadFrom(fds[0]);
+    CHECK(end.has_value() && *end == 0);
+    close(fds[0]);
+}
+
+// A chain of shared fragments goes out as it is and comes back in small reads
+void TestSocketpair() {
+    int fds[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+    BufferChain head = ChainOf("header ");
+    BufferChain body = ChainOf(Pattern(70000)).Slice(1000, 50000);
+    BufferChain message = head;
+    message.Append(body);
+    message.Append(head);
+    std::string expected = Contents(message);
+    CHECK(message.FragmentCount() > 2);
+
+    message.WriteAll(fds[0]);
+    CHECK(message.Empty());
+    CHECK(shutdown(fds[0], SHUT_WR) == 0);
+    BufferChain received;
+    while (*received.ReadFrom(fds[1], 3000) > 0) {
+    }
+    CHECK(Contents(received) == expected);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// Reads larger than a segment fill several fresh ones in one `readv`
+void TestFile() {
+    std::string bytes = Pattern(100000);
+    char name[] = "/tmp/buffer-testXXXXXX";
+    int fd = mkstemp(name);
+    CHECK(fd >= 0);
+    unlink(name);
+
+    ChainOf(bytes).WriteAll(fd);
+    CHECK(lseek(fd, 0, SEEK_SET) == 0);
+    BufferChain chain;
+    while (*chain.ReadFrom(fd, 1 << 20) > 0) {
+    }
+    CHECK(Contents(chain) == bytes);
+
+    bool threw = false;
+    try {
+        chain.ReadFrom(fd, 0);
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    CHECK(threw);
+    close(fd);
+}
+
+}  // namespace
+
+int main() {
+    TestPipe();
+    TestSocketpair();
+    TestFile();
+    std::printf("ok\n");
+}
@@ -0,0 +1,321 @@
+#pragma once
+
+#include "../shared-from-this/shared.h"
+#include "../shared-from-this/weak.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+struct WeakValueCacheStats {
+    size_t hits;
+    size_t misses;
+    size_t expired;
+};
+
+// Concurrent map from keys to `WeakPtr<V>`: the cache never extends the lifetime of what it
+// holds. Keys are spread over independently locked shards, each an open-addressing table with
+// linear probing. Entries whose object died are reclaimed lazily, when a probe runs over them,
+// and by `Sweep()`, which can also be run periodically from a background thread.
+template <typename K, typename V, typename Hash = std::hash<K>>
+class WeakValueCache {
+public:
+    // Throws `std::invalid_argument` if `shards` is zero
+    explicit WeakValueCache(size_t shards = 16);
+    WeakValueCache(const WeakValueCache& other) = delete;
+    WeakValueCache& operator=(const WeakValueCache& other) = delete;
+    ~WeakValueCache();
+
+    // Returns the live object for `key`, or stores and returns `factory()` if there is none.
+    // The factory runs under the shard lock, so concurrent callers never create duplicates.
+    template <typename Factory>
+    SharedPtr<V> GetOrCreate(const K& key, Factory&& factory);
+    SharedPtr<V> Get(const K& key);
+    void Insert(const K& key, const SharedPtr<V>& value);
+    bool Erase(const K& key);
+
+    // Drops every expired entry; returns how many were dropped
+    size_t Sweep();
+    void StartBackgroundSweep(std::chrono::milliseconds period);
+    void StopBackgroundSweep();
+
+    // Number of occupied entries, expired ones included
+    size_t Size() const;
+    WeakValueCacheStats Stats() const;
+
+private:
+    enum class SlotState : uint8_t { kEmpty, kFull, kDeleted };
+
+    struct Slot {
+        SlotState state = SlotState::kEmpty;
+        size_t hash = 0;
+        K key{};
+        WeakPtr<V> value;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::vector<Slot> slots;
+        size_t used = 0;  // Full and deleted slots: both lengthen probe sequences
+        size_t full = 0;
+    };
+
+    static constexpr size_t kInitialShardCapacity = 16;
+
+    size_t HashOf(const K& key) const;
+    Shard& ShardFor(size_t hash);
+    // Index of the live or expired entry for `key`, or of the slot to insert it into. Expired
+    // entries of other keys met on the way are reclaimed.
+    size_t Probe(Shard& shard, size_t hash, const K& key, bool* found);
+    void Store(Shard& shard, size_t index, size_t hash, const K& key, const SharedPtr<V>& value);
+    void Reclaim(Shard& shard, Slot& slot);
+    void Rehash(Shard& shard);
+
+    std::vector<Shard> shards_;
+    Hash hash_;
+    std::atomic<size_t> hits_;
+    std::atomic<size_t> misses_;
+    std::atomic<size_t> expired_;
+
+    std::thread sweeper_;
+    std::mutex sweeper_mutex_;
+    std::condition_variable sweeper_cv_;
+    bool sweeper_stop_;
+};
+template <typename K, typename V, typename Hash>
+WeakValueCache<K, V, Hash>::WeakValueCache(size_t shards)
+    : shards_(shards), hits_(0), misses_(0), expired_(0), sweeper_stop_(false) {
+    if (shards == 0) {
+        throw std::invalid_argument("WeakValueCache needs at least one shard");
+    }
+    for (auto& shard : shards_) {
+        shard.slots.resize(kInitialShardCapacity);
+    }
+}
+template <typename K, typename V, typename Hash>
+WeakValueCache<K, V, Hash>::~WeakValueCache() {
+    StopBackgroundSweep();
+}
+template <typename K, typename V, typename Hash>
+size_t WeakValueCache<K, V, Hash>::HashOf(const K& key) const {
+    // Finalizer of splitmix64: `std::hash` of integers is the identity
+    uint64_t h = hash_(key);
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111eb;
+    return h ^ (h >> 31);
+}
+template <typename K, typename V, typename Hash>
+typename WeakValueCache<K, V, Hash>::Shard& WeakValueCache<K, V, Hash>::ShardFor(size_t hash) {
+    // High bits pick the shard, low bits the slot inside it
+    return shards_[(hash >> 48) % shards_.size()];
+}
+template <typename K, typename V, typename Hash>
+void WeakValueCache<K, V, Hash>::Reclaim(Shard& shard, Slot& slot) {
+    slot.state = SlotState::kDeleted;
+    slot.value.Reset();
+    slot.key = K{};
+    --shard.full;
+}
+template <typename K, typename V, typename Hash>
+size_t WeakValueCache<K, V, Hash>::Probe(Shard& shard, size_t hash, const K& key, bool* found) {
+    size_t mask = shard.slots.size() - 1;
+    size_t insert_at = shard.slots.size();
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        Slot& slot = shard.slots[i];
+        if (slot.state == SlotState::kEmpty) {
+            *found = false;
+            return insert_at != shard.slots.size() ? insert_at : i;
+        }
+        if (slot.state == SlotState::kFull) {
+            if (slot.hash == hash && slot.key == key) {
+                *found = true;
+                return i;
+            }
+            if (slot.value.Expired()) {
+                expired_.fetch_add(1, std::memory_order_relaxed);
+                Reclaim(shard, slot);
+            }
+        }
+        if (slot.state == SlotState::kDeleted && insert_at == shard.slots.size()) {
+            insert_at = i;
+        }
+    }
+}
+template <typename K, typename V, typename Hash>
+void WeakValueCache<K, V, Hash>::Store(Shard& shard, size_t index, size_t hash, const K& key,
+                                       const SharedPtr<V>& value) {
+    Slot& slot = shard.slots[index];
+    if (slot.state == SlotState::kEmpty) {
+        ++shard.used;
+    }
+    if (slot.state != SlotState::kFull) {
+        ++shard.full;
+    }
+    slot.state = SlotState::kFull;
+    slot.hash = hash;
+    slot.key = key;
+    slot.value = WeakPtr<V>(value);
+    if (shard.used * 4 > shard.slots.size() * 3) {
+        Rehash(shard);
+    }
+}
+template <typename K, typename V, typename Hash>
+void WeakValueCache<K, V, Hash>::Rehash(Shard& shard) {
+    std::vector<Slot> old = std::move(shard.slots);
+    size_t live = 0;
+    for (const auto& slot : old) {
+        live += slot.state == SlotState::kFull && !slot.value.Expired();
+    }
+    // Expired entries are dropped rather than copied, so the table only grows for live ones
+    size_t capacity = kInitialShardCapacity;
+    while (live * 2 >= capacity) {
+        capacity *= 2;
+    }
+    shard.slots = std::vector<Slot>(capacity);
+    shard.used = shard.full = 0;
+    size_t mask = capacity - 1;
+    for (auto& slot : old) {
+        if (slot.state != SlotState::kFull) {
+            continue;
+        }
+        if (slot.value.Expired()) {
+            expired_.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        size_t i = slot.hash & mask;
+        while (shard.slots[i].state != SlotState::kEmpty) {
+            i = (i + 1) & mask;
+        }
+        shard.slots[i] = std::move(slot);
+        ++shard.used;
+        ++shard.full;
+    }
+}
+template <typename K, typename V, typename Hash>
+template <typename Factory>
+SharedPtr<V> WeakValueCache<K, V, Hash>::GetOrCreate(const K& key, Factory&& factory) {
+    size_t hash = HashOf(key);
+    Shard& shard = ShardFor(hash);
+    std::lock_guard guard(shard.mutex);
+    bool found;
+    size_t index = Probe(shard, hash, key, &found);
+    if (found) {
+        SharedPtr<V> value = shard.slots[index].value.Lock();
+        if (value) {
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            return value;
+        }
+        expired_.fetch_add(1, std::memory_order_relaxed);
+    }
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    SharedPtr<V> value = factory();
+    Store(shard, index, hash, key, value);
+    return value;
+}
+template <typename K, typename V, typename Hash>
+SharedPtr<V> WeakValueCache<K, V, Hash>::Get(const K& key) {
+    size_t hash = HashOf(key);
+    Shard& shard = ShardFor(hash);
+    std::lock_guard guard(shard.mutex);
+    bool found;
+    size_t index = Probe(shard, hash, key, &found);
+    if (found) {
+        SharedPtr<V> value = shard.slots[index].value.Lock();
+        if (value) {
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            return value;
+        }
+        expired_.fetch_add(1, std::memory_order_relaxed);
+        Reclaim(shard, shard.slots[index]);
+    }
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return SharedPtr<V>();
+}
+template <typename K, typename V, typename Hash>
+void WeakValueCache<K, V, Hash>::Insert(const K& key, const SharedPtr<V>& value) {
+    size_t hash = HashOf(key);
+    Shard& shard = ShardFor(hash);
+    std::lock_guard guard(shard.mutex);
+    bool found;
+    size_t index = Probe(shard, hash, key, &found);
+    Store(shard, index, hash, key, value);
+}
+template <typename K, typename V, typename Hash>
+bool WeakValueCache<K, V, Hash>::Erase(const K& key) {
+    size_t hash = HashOf(key);
+    Shard& shard = ShardFor(hash);
+    std::lock_guard guard(shard.mutex);
+    bool found;
+    size_t index = Probe(shard, hash, key, &found);
+    if (found) {
+        Reclaim(shard, shard.slots[index]);
+    }
+    return found;
+}
+template <typename K, typename V, typename Hash>
+size_t WeakValueCache<K, V, Hash>::Sweep() {
+    size_t dropped = 0;
+    for (auto& shard : shards_) {
+        std::lock_guard guard(shard.mutex);
+        for (auto& slot : shard.slots) {
+            if (slot.state == SlotState::kFull && slot.value.Expired()) {
+                Reclaim(shard, slot);
+                ++dropped;
+            }
+        }
+        // Tombstones only go away on rehash; do it once they dominate the table
+        if (shard.used > 2 * shard.full + kInitialShardCapacity / 2) {
+            Rehash(shard);
+        }
+    }
+    expired_.fetch_add(dropped, std::memory_order_relaxed);
+    return dropped;
+}
+template <typename K, typename V, typename Hash>
+void WeakValueCache<K, V, Hash>::StartBackgroundSweep(std::chrono::milliseconds period) {
+    StopBackgroundSweep();
+    sweeper_stop_ = false;
+    sweeper_ = std::thread([this, period] {
+        std::unique_lock lock(sweeper_mutex_);
+        while (!sweeper_cv_.wait_for(lock, period, [this] { return sweeper_stop_; })) {
+            lock.unlock();
+            Sweep();
+            lock.lock();
+        }
+    });
+}
+template <typename K, typename V, typename Hash>
+void WeakValueCache<K, V, Hash>::StopBackgroundSweep() {
+    if (!sweeper_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard guard(sweeper_mutex_);
+        sweeper_stop_ = true;
+    }
+    sweeper_cv_.notify_all();
+    sweeper_.join();
+}
+template <typename K, typename V, typename Hash>
+size_t WeakValueCache<K, V, Hash>::Size() const {
+    size_t size = 0;
+    for (const auto& shard : shards_) {
+        std::lock_guard guard(shard.mutex);
+        size += shard.full;
+    }
+    return size;
+}
+template <typename K, typename V, typename Hash>
+WeakValueCacheStats WeakValueCache<K, V, Hash>::Stats() const {
+    return WeakValueCacheStats{hits_.load(std::memory_order_relaxed),
+                               misses_.load(std::memory_order_relaxed),
+                               expired_.load(std::memory_order_relaxed)};
+}
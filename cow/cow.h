@@ -0,0 +1,109 @@
+#pragma once
+
+#include "../shared-from-this/shared.h"
+
+#include <cstddef>
+#include <utility>
+
+// Value of type `T` with copy-on-write semantics: copies of a `CowPtr` share one object, and the
+// first mutable access through a copy that is not the only owner clones it. Passing large,
+// rarely mutated values (snapshots, option sets) around by value then costs a counter increment.
+//
+// The object is never reachable other than through `CowPtr`s, so a use count of one means no one
+// else can be looking at it. Distinct `CowPtr`s sharing a value may be used from different
+// threads; a single `CowPtr` is as thread-safe as a `T` would be. References returned by
+// `Mutable()` are invalidated by the next copy of this `CowPtr` that gets mutated.
+//
+// A moved-from `CowPtr` reads as a value-initialized `T`, shared by all of them, and allocates
+// its own again on the first `Mutable()`.
+template <typename T>
+class CowPtr {
+public:
+    template <typename Y, typename... Args>
+    friend CowPtr<Y> MakeCow(Args&&... args);
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    // Value-initialized `T`
+    CowPtr();
+    explicit CowPtr(T value);
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    // The object, cloned first unless this is its only owner
+    T& Mutable();
+    void Swap(CowPtr& other);
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    const T* Get() const;
+    const T& operator*() const;
+    const T* operator->() const;
+    size_t UseCount() const;
+    bool IsUnique() const;
+
+private:
+    explicit CowPtr(SharedPtr<T> ptr);
+
+    static const T& Empty();
+
+    SharedPtr<T> ptr_;  // Null only after a move
+};
+template <typename T>
+CowPtr<T>::CowPtr() : ptr_(MakeShared<T>()) {
+}
+template <typename T>
+CowPtr<T>::CowPtr(T value) : ptr_(MakeShared<T>(std::move(value))) {
+}
+template <typename T>
+CowPtr<T>::CowPtr(SharedPtr<T> ptr) : ptr_(std::move(ptr)) {
+}
+template <typename T>
+T& CowPtr<T>::Mutable() {
+    // The acquire load of the count orders this after the other owners' last reads, which
+    // happened before they released their references
+    if (!ptr_) {
+        ptr_ = MakeShared<T>();
+    } else if (!IsUnique()) {
+        ptr_ = MakeShared<T>(static_cast<const T&>(*ptr_));
+    }
+    return *ptr_;
+}
+template <typename T>
+void CowPtr<T>::Swap(CowPtr& other) {
+    ptr_.Swap(other.ptr_);
+}
+template <typename T>
+const T* CowPtr<T>::Get() const {
+    return ptr_ ? ptr_.Get() : &Empty();
+}
+template <typename T>
+const T& CowPtr<T>::operator*() const {
+    return *Get();
+}
+template <typename T>
+const T* CowPtr<T>::operator->() const {
+    return Get();
+}
+template <typename T>
+size_t CowPtr<T>::UseCount() const {
+    return ptr_.UseCount();
+}
+template <typename T>
+bool CowPtr<T>::IsUnique() const {
+    return ptr_.UseCount() == 1;
+}
+template <typename T>
+const T& CowPtr<T>::Empty() {
+    static const T empty{};
+    return empty;
+}
+
+// Constructs the value in place, in one allocation with its counters
+template <typename T, typename... Args>
+CowPtr<T> MakeCow(Args&&... args) {
+    return CowPtr<T>(MakeShared<T>(std::forward<Args>(args)...));
+}
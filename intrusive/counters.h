@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+// What a narrow counter does when one more reference would not fit: throw, leaving the count as
+// it was, or stick at the maximum, which makes the object immortal. A leaked object is the price
+// of saturation; a wrapped count would free an object that is still referenced.
+enum class CounterOverflow { kThrow, kSaturate };
+
+// `Counter` policy for `RefCounted` narrower than `SimpleCounter`'s `size_t`: with a 32- or
+// 16-bit count the derived class's own fields start right after it instead of after 8 bytes.
+template <typename Int, CounterOverflow Overflow = CounterOverflow::kSaturate>
+class CompactCounter {
+public:
+    static_assert(std::is_unsigned_v<Int>);
+
+    void IncRef();
+    void DecRef();
+    size_t RefCount() const;
+    void Reset();
+    bool IsImmortal() const;
+
+private:
+    static constexpr Int kMax = std::numeric_limits<Int>::max();
+
+    Int count_ = 0;
+};
+template <typename Int, CounterOverflow Overflow>
+void CompactCounter<Int, Overflow>::IncRef() {
+    if (count_ == kMax) {
+        if constexpr (Overflow == CounterOverflow::kThrow) {
+            throw std::overflow_error("CompactCounter: too many references");
+        } else {
+            return;
+        }
+    }
+    ++count_;
+}
+template <typename Int, CounterOverflow Overflow>
+void CompactCounter<Int, Overflow>::DecRef() {
+    if (Overflow == CounterOverflow::kSaturate && count_ == kMax) {
+        return;
+    }
+    --count_;
+}
+template <typename Int, CounterOverflow Overflow>
+size_t CompactCounter<Int, Overflow>::RefCount() const {
+    return count_;
+}
+template <typename Int, CounterOverflow Overflow>
+void CompactCounter<Int, Overflow>::Reset() {
+    count_ = 0;
+}
+template <typename Int, CounterOverflow Overflow>
+bool CompactCounter<Int, Overflow>::IsImmortal() const {
+    return Overflow == CounterOverflow::kSaturate && count_ == kMax;
+}
+
+using Counter32 = CompactCounter<uint32_t>;
+using Counter16 = CompactCounter<uint16_t>;
+
+// Counter sharing a `Word` with a payload of the derived class, e.g. a string atom's length or
+// an AST node's kind: the low `CountBits` bits count references, the rest are the payload's.
+// The derived class reaches it through `RefCounted::RefCounter()`.
+template <typename Word, size_t CountBits, CounterOverflow Overflow = CounterOverflow::kSaturate>
+class PackedCounter {
+public:
+    static_assert(std::is_unsigned_v<Word>);
+    static_assert(CountBits > 0 && CountBits < std::numeric_limits<Word>::digits);
+
+    static constexpr size_t kPayloadBits = std::numeric_limits<Word>::digits - CountBits;
+
+    void IncRef();
+    void DecRef();
+    size_t RefCount() const;
+    // Clears the count only; the payload belongs to the object
+    void Reset();
+    bool IsImmortal() const;
+
+    Word Payload() const;
+    // Bits of `payload` above `kPayloadBits` are dropped
+    void SetPayload(Word payload);
+
+private:
+    static constexpr Word kCountMask = (Word{1} << CountBits) - 1;
+
+    Word word_ = 0;
+};
+template <typename Word, size_t CountBits, CounterOverflow Overflow>
+void PackedCounter<Word, CountBits, Overflow>::IncRef() {
+    if ((word_ & kCountMask) == kCountMask) {
+        if constexpr (Overflow == CounterOverflow::kThrow) {
+            throw std::overflow_error("PackedCounter: too many references");
+        } else {
+            return;
+        }
+    }
+    ++word_;
+}
+template <typename Word, size_t CountBits, CounterOverflow Overflow>
+void PackedCounter<Word, CountBits, Overflow>::DecRef() {
+    if (Overflow == CounterOverflow::kSaturate && (word_ & kCountMask) == kCountMask) {
+        return;
+    }
+    --word_;
+}
+template <typename Word, size_t CountBits, CounterOverflow Overflow>
+size_t PackedCounter<Word, CountBits, Overflow>::RefCount() const {
+    return word_ & kCountMask;
+}
+template <typename Word, size_t CountBits, CounterOverflow Overflow>
+void PackedCounter<Word, CountBits, Overflow>::Reset() {
+    word_ &= static_cast<Word>(~kCountMask);
+}
+template <typename Word, size_t CountBits, CounterOverflow Overflow>
+bool PackedCounter<Word, CountBits, Overflow>::IsImmortal() const {
+    return Overflow == CounterOverflow::kSaturate && (word_ & kCountMask) == kCountMask;
+}
+template <typename Word, size_t CountBits, CounterOverflow Overflow>
+Word PackedCounter<Word, CountBits, Overflow>::Payload() const {
+    return word_ >> CountBits;
+}
+template <typename Word, size_t CountBits, CounterOverflow Overflow>
+void PackedCounter<Word, CountBits, Overflow>::SetPayload(Word payload) {
+    word_ = static_cast<Word>(payload << CountBits) | (word_ & kCountMask);
+}
@@ -1,7 +1,10 @@
 #pragma once
 
-#include <cstddef>  // for std::nullptr_t
-#include <utility>  // for std::exchange / std::swap
+#include "../trace/hooks.h"
+
+#include <cstddef>      // for std::nullptr_t
+#include <type_traits>  // for std::is_same_v, std::true_type
+#include <utility>      // for std::exchange / std::swap
 
 class SimpleCounter {
 public:
@@ -46,6 +49,16 @@ public:
     // Get current counter value (the number of strong references).
     size_t RefCount() const;
 
+    // Only for counters with a live mode, such as `PercpuCounter`: drop the object's base
+    // reference, so that the last `DecRef` destroys it.
+    void Kill();
+
+#ifdef SMART_PTR_HEAP_PROFILE
+    HeapSampleSlot& HeapProfileSlot() {
+        return heap_sample_;
+    }
+#endif
+
     //    ~RefCounted();
 
     auto operator=(const RefCounted& other) {
@@ -57,8 +70,17 @@ public:
         return *this;
     }
 
+protected:
+    // For counters with state of their own, such as a `PackedCounter` payload
+    Counter& RefCounter();
+    const Counter& RefCounter() const;
+
 private:
     Counter counter_;
+#ifdef SMART_PTR_HEAP_PROFILE
+    // Sample of the object's allocation by `MakeIntrusive`, dropped with the object
+    HeapSampleSlot heap_sample_;
+#endif
 };
 template <typename Derived, typename Counter, typename Deleter>
 void RefCounted<Derived, Counter, Deleter>::IncRef() {
@@ -66,15 +88,40 @@ void RefCounted<Derived, Counter, Deleter>::IncRef() {
 }
 template <typename Derived, typename Counter, typename Deleter>
 void RefCounted<Derived, Counter, Deleter>::DecRef() {
-    counter_.DecRef();
-    if (counter_.RefCount() == 0) {
-        Deleter::Destroy(static_cast<Derived*>(this));
+    // Counters shared between threads report the last release themselves; reading the count
+    // back after decrementing would race with other threads' decrements
+    if constexpr (std::is_same_v<decltype(counter_.DecRef()), bool>) {
+        if (counter_.DecRef()) {
+            SMART_PTR_TRACE_DESTROY(static_cast<Derived*>(this));
+            Deleter::Destroy(static_cast<Derived*>(this));
+        }
+    } else {
+        counter_.DecRef();
+        if (counter_.RefCount() == 0) {
+            SMART_PTR_TRACE_DESTROY(static_cast<Derived*>(this));
+            Deleter::Destroy(static_cast<Derived*>(this));
+        }
     }
 }
 template <typename Derived, typename Counter, typename Deleter>
 size_t RefCounted<Derived, Counter, Deleter>::RefCount() const {
     return counter_.RefCount();
 }
+template <typename Derived, typename Counter, typename Deleter>
+void RefCounted<Derived, Counter, Deleter>::Kill() {
+    if (counter_.Kill()) {
+        SMART_PTR_TRACE_DESTROY(static_cast<Derived*>(this));
+        Deleter::Destroy(static_cast<Derived*>(this));
+    }
+}
+template <typename Derived, typename Counter, typename Deleter>
+Counter& RefCounted<Derived, Counter, Deleter>::RefCounter() {
+    return counter_;
+}
+template <typename Derived, typename Counter, typename Deleter>
+const Counter& RefCounted<Derived, Counter, Deleter>::RefCounter() const {
+    return counter_;
+}
 // template <typename Derived, typename Counter, typename Deleter>
 // RefCounted<Derived, Counter, Deleter>::~RefCounted() {
 //     Deleter::Destroy(static_cast<Derived*>(this));
@@ -119,6 +166,10 @@ public:
     void Reset();
     void Reset(T* ptr);
     void Swap(IntrusivePtr& other);
+    // Gives up the reference without dropping it, leaving the pointer empty
+    T* Release();
+    // Takes over a reference the caller already holds, e.g. one given up by `Release`
+    static IntrusivePtr Adopt(T* ptr);
 
     // Observers
     T* Get() const;
@@ -126,6 +177,8 @@ public:
     T* operator->() const;
     size_t UseCount() const;
     explicit operator bool() const;
+    // The counter lives in the object, so the object is its own owner
+    const void* OwnerId() const;
 
 private:
     void Clear();
@@ -211,6 +264,16 @@ void IntrusivePtr<T>::Swap(IntrusivePtr& other) {
     other = std::move(tmp);
 }
 template <typename T>
+T* IntrusivePtr<T>::Release() {
+    return std::exchange(ptr_, nullptr);
+}
+template <typename T>
+IntrusivePtr<T> IntrusivePtr<T>::Adopt(T* ptr) {
+    IntrusivePtr<T> result;
+    result.ptr_ = ptr;
+    return result;
+}
+template <typename T>
 T* IntrusivePtr<T>::Get() const {
     return ptr_;
 }
@@ -231,6 +294,10 @@ IntrusivePtr<T>::operator bool() const {
     return ptr_ != nullptr;
 }
 template <typename T>
+const void* IntrusivePtr<T>::OwnerId() const {
+    return ptr_;
+}
+template <typename T>
 void IntrusivePtr<T>::IncRef() {
     if (ptr_) {
         ptr_->IncRef();
@@ -241,7 +308,51 @@ size_t IntrusivePtr<T>::RefCount() const {
     return (ptr_ ? ptr_->RefCount() : 0);
 }
 
+template <typename Derived, typename Counter, typename Deleter>
+std::true_type IsRefCountedTest(const RefCounted<Derived, Counter, Deleter>*);
+std::false_type IsRefCountedTest(...);
+template <typename T>
+inline constexpr bool kIsRefCounted = decltype(IsRefCountedTest(std::declval<T*>()))::value;
+
 template <typename T, typename... Args>
 IntrusivePtr<T> MakeIntrusive(Args&&... args) {
-    return IntrusivePtr<T>(new T{std::forward<Args>(args)...});
+    T* object = new T{std::forward<Args>(args)...};
+    SMART_PTR_HEAP_SAMPLE(object, sizeof(T));
+    // Creation is traced here, where the object is allocated, and only for `RefCounted` types,
+    // whose destruction is traced too; the raw-pointer constructor also re-wraps live objects
+    if constexpr (kIsRefCounted<T>) {
+        SMART_PTR_TRACE_CREATE(object);
+    }
+    return IntrusivePtr<T>(object);
+}
+
+// The rvalue overloads take `ptr`'s reference over instead of adding one; a failed
+// `DynamicPointerCast` leaves `ptr` as it was
+template <typename T, typename Y>
+IntrusivePtr<T> StaticPointerCast(const IntrusivePtr<Y>& ptr) {
+    return IntrusivePtr<T>(static_cast<T*>(ptr.Get()));
+}
+template <typename T, typename Y>
+IntrusivePtr<T> StaticPointerCast(IntrusivePtr<Y>&& ptr) {
+    return IntrusivePtr<T>::Adopt(static_cast<T*>(ptr.Release()));
+}
+template <typename T, typename Y>
+IntrusivePtr<T> DynamicPointerCast(const IntrusivePtr<Y>& ptr) {
+    return IntrusivePtr<T>(dynamic_cast<T*>(ptr.Get()));
+}
+template <typename T, typename Y>
+IntrusivePtr<T> DynamicPointerCast(IntrusivePtr<Y>&& ptr) {
+    if (T* cast = dynamic_cast<T*>(ptr.Get())) {
+        ptr.Release();
+        return IntrusivePtr<T>::Adopt(cast);
+    }
+    return IntrusivePtr<T>();
+}
+template <typename T, typename Y>
+IntrusivePtr<T> ConstPointerCast(const IntrusivePtr<Y>& ptr) {
+    return IntrusivePtr<T>(const_cast<T*>(ptr.Get()));
+}
+template <typename T, typename Y>
+IntrusivePtr<T> ConstPointerCast(IntrusivePtr<Y>&& ptr) {
+    return IntrusivePtr<T>::Adopt(const_cast<T*>(ptr.Release()));
 }
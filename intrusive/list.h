@@ -0,0 +1,318 @@
+#pragma once
+
+#include "intrusive.h"
+
+#include <cstddef>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+// Links embedded in a `RefCounted` object so that it can sit in an `IntrusiveList` without a
+// node of its own. An object may be in as many lists at once as it has hooks. Copying an object
+// does not copy its links.
+class ListHook {
+public:
+    ListHook() : prev_(nullptr), next_(nullptr) {
+    }
+    ListHook(const ListHook&) : ListHook() {
+    }
+    ListHook& operator=(const ListHook&) {
+        return *this;
+    }
+
+    bool IsLinked() const {
+        return next_ != nullptr;
+    }
+
+private:
+    template <typename T, ListHook T::*Hook>
+    friend class IntrusiveList;
+
+    ListHook* prev_;
+    ListHook* next_;
+};
+
+// Doubly-linked list threaded through `T::*Hook`. Every linked object holds one reference owned
+// by the list: linking takes an `IntrusivePtr` over, unlinking hands it back, so an object in a
+// list stays alive and moving it between lists touches neither the counter nor the heap.
+template <typename T, ListHook T::*Hook>
+class IntrusiveList {
+public:
+    template <bool Const>
+    class Iterator;
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    IntrusiveList();
+    IntrusiveList(IntrusiveList&& other) noexcept;
+    IntrusiveList(const IntrusiveList& other) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    IntrusiveList& operator=(IntrusiveList&& other) noexcept;
+    IntrusiveList& operator=(const IntrusiveList& other) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~IntrusiveList();
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    // The object must not be linked through `Hook` already, or `std::invalid_argument` is thrown
+    void PushBack(IntrusivePtr<T> object);
+    void PushFront(IntrusivePtr<T> object);
+    // Links `object` right before `position`, which must be in this list. Throws
+    // `std::invalid_argument` if `position` is not linked at all (which list is not checked).
+    void InsertBefore(T& position, IntrusivePtr<T> object);
+    // Empty pointers if the list is empty
+    IntrusivePtr<T> PopFront();
+    IntrusivePtr<T> PopBack();
+    // Unlinks `object`, which must be in this list, in O(1) and returns the list's reference.
+    // Throws `std::invalid_argument` if `object` is not linked, as for `InsertBefore`.
+    IntrusivePtr<T> Erase(T& object);
+    // Moves every object of `other` to the back of this list
+    void Splice(IntrusiveList& other);
+    void Clear();
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T* Front() const;
+    T* Back() const;
+    size_t Size() const;
+    bool Empty() const;
+    static bool IsLinked(const T& object);
+
+    iterator begin();
+    iterator end();
+    const_iterator begin() const;
+    const_iterator end() const;
+
+private:
+    static T* ObjectOf(ListHook* hook);
+    static const T* ObjectOf(const ListHook* hook);
+    void Link(ListHook* position, IntrusivePtr<T> object);
+    static void LinkBefore(ListHook* position, ListHook* hook);
+    static void Unlink(ListHook* hook);
+    // Points the neighbours of a list moved into `head_` at the new sentinel
+    void TakeLinks(IntrusiveList& other);
+
+    ListHook head_;  // Sentinel of a circular list, so no link is ever null while linked
+    size_t size_;
+};
+
+template <typename T, ListHook T::*Hook>
+template <bool Const>
+class IntrusiveList<T, Hook>::Iterator {
+public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = std::conditional_t<Const, const T*, T*>;
+    using reference = std::conditional_t<Const, const T&, T&>;
+
+    Iterator() : hook_(nullptr) {
+    }
+
+    reference operator*() const {
+        return *ObjectOf(hook_);
+    }
+    pointer operator->() const {
+        return ObjectOf(hook_);
+    }
+    Iterator& operator++() {
+        hook_ = hook_->next_;
+        return *this;
+    }
+    Iterator operator++(int) {
+        Iterator result = *this;
+        ++*this;
+        return result;
+    }
+    Iterator& operator--() {
+        hook_ = hook_->prev_;
+        return *this;
+    }
+    Iterator operator--(int) {
+        Iterator result = *this;
+        --*this;
+        return result;
+    }
+    bool operator==(const Iterator& other) const {
+        return hook_ == other.hook_;
+    }
+    bool operator!=(const Iterator& other) const {
+        return hook_ != other.hook_;
+    }
+
+private:
+    friend class IntrusiveList;
+
+    explicit Iterator(ListHook* hook) : hook_(hook) {
+    }
+
+    ListHook* hook_;
+};
+
+template <typename T, ListHook T::*Hook>
+T* IntrusiveList<T, Hook>::ObjectOf(ListHook* hook) {
+    // The offset of the hook, measured on storage that is never constructed
+    alignas(T) static char probe[sizeof(T)];
+    auto offset = reinterpret_cast<char*>(&(reinterpret_cast<T*>(probe)->*Hook)) - probe;
+    return reinterpret_cast<T*>(reinterpret_cast<char*>(hook) - offset);
+}
+template <typename T, ListHook T::*Hook>
+const T* IntrusiveList<T, Hook>::ObjectOf(const ListHook* hook) {
+    return ObjectOf(const_cast<ListHook*>(hook));
+}
+template <typename T, ListHook T::*Hook>
+void IntrusiveList<T, Hook>::LinkBefore(ListHook* position, ListHook* hook) {
+    hook->prev_ = position->prev_;
+    hook->next_ = position;
+    position->prev_->next_ = hook;
+    position->prev_ = hook;
+}
+template <typename T, ListHook T::*Hook>
+void IntrusiveList<T, Hook>::Unlink(ListHook* hook) {
+    hook->prev_->next_ = hook->next_;
+    hook->next_->prev_ = hook->prev_;
+    hook->prev_ = hook->next_ = nullptr;
+}
+template <typename T, ListHook T::*Hook>
+IntrusiveList<T, Hook>::IntrusiveList() : size_(0) {
+    head_.prev_ = head_.next_ = &head_;
+}
+template <typename T, ListHook T::*Hook>
+IntrusiveList<T, Hook>::IntrusiveList(IntrusiveList&& other) noexcept : IntrusiveList() {
+    TakeLinks(other);
+}
+template <typename T, ListHook T::*Hook>
+IntrusiveList<T, Hook>& IntrusiveList<T, Hook>::operator=(IntrusiveList&& other) noexcept {
+    if (&other == this) {
+        return *this;
+    }
+    Clear();
+    TakeLinks(other);
+    return *this;
+}
+template <typename T, ListHook T::*Hook>
+IntrusiveList<T, Hook>::~IntrusiveList() {
+    Clear();
+}
+template <typename T, ListHook T::*Hook>
+void IntrusiveList<T, Hook>::TakeLinks(IntrusiveList& other) {
+    if (other.Empty()) {
+        return;
+    }
+    head_.next_ = other.head_.next_;
+    head_.prev_ = other.head_.prev_;
+    head_.next_->prev_ = &head_;
+    head_.prev_->next_ = &head_;
+    size_ = std::exchange(other.size_, 0);
+    other.head_.prev_ = other.head_.next_ = &other.head_;
+}
+template <typename T, ListHook T::*Hook>
+void IntrusiveList<T, Hook>::Link(ListHook* position, IntrusivePtr<T> object) {
+    if (!object || IsLinked(*object)) {
+        throw std::invalid_argument("IntrusiveList: object is null or already linked");
+    }
+    LinkBefore(position, &(object.Release()->*Hook));
+    ++size_;
+}
+template <typename T, ListHook T::*Hook>
+void IntrusiveList<T, Hook>::PushBack(IntrusivePtr<T> object) {
+    Link(&head_, std::move(object));
+}
+template <typename T, ListHook T::*Hook>
+void IntrusiveList<T, Hook>::PushFront(IntrusivePtr<T> object) {
+    Link(head_.next_, std::move(object));
+}
+template <typename T, ListHook T::*Hook>
+void IntrusiveList<T, Hook>::InsertBefore(T& position, IntrusivePtr<T> object) {
+    if (!IsLinked(position)) {
+        throw std::invalid_argument("IntrusiveList: position is not linked");
+    }
+    Link(&(position.*Hook), std::move(object));
+}
+template <typename T, ListHook T::*Hook>
+IntrusivePtr<T> IntrusiveList<T, Hook>::PopFront() {
+    return Empty() ? IntrusivePtr<T>() : Erase(*ObjectOf(head_.next_));
+}
+template <typename T, ListHook T::*Hook>
+IntrusivePtr<T> IntrusiveList<T, Hook>::PopBack() {
+    return Empty() ? IntrusivePtr<T>() : Erase(*ObjectOf(head_.prev_));
+}
+template <typename T, ListHook T::*Hook>
+IntrusivePtr<T> IntrusiveList<T, Hook>::Erase(T& object) {
+    if (!IsLinked(object)) {
+        throw std::invalid_argument("IntrusiveList: erasing an object that is not linked");
+    }
+    Unlink(&(object.*Hook));
+    --size_;
+    return IntrusivePtr<T>::Adopt(&object);
+}
+template <typename T, ListHook T::*Hook>
+void IntrusiveList<T, Hook>::Splice(IntrusiveList& other) {
+    if (&other == this || other.Empty()) {
+        return;
+    }
+    ListHook* first = other.head_.next_;
+    ListHook* last = other.head_.prev_;
+    first->prev_ = head_.prev_;
+    head_.prev_->next_ = first;
+    last->next_ = &head_;
+    head_.prev_ = last;
+    size_ += std::exchange(other.size_, 0);
+    other.head_.prev_ = other.head_.next_ = &other.head_;
+}
+template <typename T, ListHook T::*Hook>
+void IntrusiveList<T, Hook>::Clear() {
+    // Each reference is dropped after its object is unlinked, so a destructor that touches
+    // the list sees it consistent
+    while (!Empty()) {
+        PopFront();
+    }
+}
+template <typename T, ListHook T::*Hook>
+T* IntrusiveList<T, Hook>::Front() const {
+    return Empty() ? nullptr : ObjectOf(head_.next_);
+}
+template <typename T, ListHook T::*Hook>
+T* IntrusiveList<T, Hook>::Back() const {
+    return Empty() ? nullptr : ObjectOf(head_.prev_);
+}
+template <typename T, ListHook T::*Hook>
+size_t IntrusiveList<T, Hook>::Size() const {
+    return size_;
+}
+template <typename T, ListHook T::*Hook>
+bool IntrusiveList<T, Hook>::Empty() const {
+    return size_ == 0;
+}
+template <typename T, ListHook T::*Hook>
+bool IntrusiveList<T, Hook>::IsLinked(const T& object) {
+    return (object.*Hook).IsLinked();
+}
+template <typename T, ListHook T::*Hook>
+typename IntrusiveList<T, Hook>::iterator IntrusiveList<T, Hook>::begin() {
+    return iterator(head_.next_);
+}
+template <typename T, ListHook T::*Hook>
+typename IntrusiveList<T, Hook>::iterator IntrusiveList<T, Hook>::end() {
+    return iterator(&head_);
+}
+template <typename T, ListHook T::*Hook>
+typename IntrusiveList<T, Hook>::const_iterator IntrusiveList<T, Hook>::begin() const {
+    return const_iterator(head_.next_);
+}
+template <typename T, ListHook T::*Hook>
+typename IntrusiveList<T, Hook>::const_iterator IntrusiveList<T, Hook>::end() const {
+    return const_iterator(const_cast<ListHook*>(&head_));
+}
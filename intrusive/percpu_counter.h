@@ -0,0 +1,56 @@
+#pragma once
+
+#include "../sharded/percpu.h"
+
+#include <atomic>
+#include <cstddef>
+
+// `Counter` policy for long-lived `RefCounted` objects referenced from every core, after Linux
+// `percpu_ref`: while live, `IncRef`/`DecRef` only write the calling thread's cache line, and no
+// decrement can free the object. The object holds a base reference of its own from construction
+// on; `RefCounted::Kill()` switches the count to a single atomic and drops that reference, after
+// which the last `DecRef` destroys the object. An object that is never killed is never freed.
+//
+// Every object carries one padded slot per CPU, so this is for the few objects that are hot,
+// not for the many that are small.
+class PercpuCounter {
+public:
+    explicit PercpuCounter(size_t slots = PercpuDefaultSlots());
+
+    void IncRef();
+    // Returns `true` if this dropped the last reference, which is only possible after `Kill`
+    bool DecRef();
+    // A racy snapshot while live, excluding the base reference; exact once killed
+    size_t RefCount() const;
+
+    // Returns `true` if the base reference was the last one. Calls after the first do nothing.
+    bool Kill();
+    bool IsKilled() const;
+
+private:
+    PercpuCount count_;
+    std::atomic<bool> killing_;
+};
+inline PercpuCounter::PercpuCounter(size_t slots) : count_(slots), killing_(false) {
+}
+inline void PercpuCounter::IncRef() {
+    count_.Increase();
+}
+inline bool PercpuCounter::DecRef() {
+    return count_.Decrease();
+}
+inline size_t PercpuCounter::RefCount() const {
+    int64_t count = count_.Get() - (count_.IsKilled() ? 0 : 1);
+    return count > 0 ? static_cast<size_t>(count) : 0;
+}
+inline bool PercpuCounter::Kill() {
+    if (killing_.exchange(true, std::memory_order_acq_rel)) {
+        return false;
+    }
+    // The base reference keeps the folded count above zero, so only the decrement can end it
+    count_.Kill();
+    return count_.Decrease();
+}
+inline bool PercpuCounter::IsKilled() const {
+    return count_.IsKilled();
+}
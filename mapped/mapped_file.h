@@ -0,0 +1,175 @@
+#pragma once
+
+#include "../shared-from-this/shared.h"
+#include "../unique/unique.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+#include <fcntl.h>     // open
+#include <sys/mman.h>  // mmap, madvise
+#include <sys/stat.h>  // fstat
+#include <unistd.h>    // close, sysconf
+
+struct MunmapDeleter {
+    void operator()(void* ptr) const {
+        munmap(ptr, length);
+    }
+
+    size_t length = 0;
+};
+
+// A read-only mapping. Owned through a `SharedPtr` by the file and by every slice of it, so it is
+// unmapped once the last of them is gone.
+class MappedRegion {
+public:
+    MappedRegion(void* base, size_t length);
+
+    const char* Data() const;
+    size_t Size() const;
+
+private:
+    UniquePtr<void, MunmapDeleter> mapping_;
+};
+inline MappedRegion::MappedRegion(void* base, size_t length)
+    : mapping_(base, MunmapDeleter{length}) {
+}
+inline const char* MappedRegion::Data() const {
+    return static_cast<const char*>(mapping_.Get());
+}
+inline size_t MappedRegion::Size() const {
+    return mapping_.GetDeleter().length;
+}
+
+enum class MappedAdvice { kNormal, kSequential, kRandom, kWillNeed, kDontNeed, kHugePage };
+
+// Read-only view of a whole file. Slices share the mapping instead of copying out of it, and stay
+// valid after the file object is gone.
+class MappedFile {
+public:
+    MappedFile();
+
+    static MappedFile Open(const std::string& path);
+    // Maps the file behind `fd`, which stays open and owned by the caller
+    static MappedFile FromFd(int fd);
+
+    const char* Data() const;
+    size_t Size() const;
+
+    // `count` elements of `T` starting `offset` bytes into the file. Throws `std::out_of_range`
+    // if they do not fit and `std::invalid_argument` if they would be misaligned.
+    template <typename T = char>
+    SharedPtr<const T> Slice(size_t offset, size_t count) const;
+
+    // Hints for the kernel about the whole mapping or the pages covering a range of it; returns
+    // `false` if it rejected the hint (e.g. huge pages for a file it cannot back with them)
+    bool Advise(MappedAdvice advice) const;
+    bool Advise(MappedAdvice advice, size_t offset, size_t length) const;
+
+private:
+    explicit MappedFile(SharedPtr<MappedRegion> region);
+
+    SharedPtr<MappedRegion> region_;
+};
+inline MappedFile::MappedFile() : region_(MakeShared<MappedRegion>(nullptr, size_t{0})) {
+}
+inline MappedFile::MappedFile(SharedPtr<MappedRegion> region) : region_(std::move(region)) {
+}
+inline MappedFile MappedFile::Open(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "open " + path);
+    }
+    try {
+        MappedFile file = FromFd(fd);
+        close(fd);
+        return file;
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+}
+inline MappedFile MappedFile::FromFd(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        throw std::system_error(errno, std::generic_category(), "fstat");
+    }
+    auto size = static_cast<size_t>(st.st_size);
+    if (size == 0) {
+        // Zero-length mappings are not allowed
+        return MappedFile();
+    }
+    void* base = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+        throw std::system_error(errno, std::generic_category(), "mmap");
+    }
+    try {
+        return MappedFile(MakeShared<MappedRegion>(base, size));
+    } catch (...) {
+        munmap(base, size);
+        throw;
+    }
+}
+inline const char* MappedFile::Data() const {
+    return region_->Data();
+}
+inline size_t MappedFile::Size() const {
+    return region_->Size();
+}
+template <typename T>
+SharedPtr<const T> MappedFile::Slice(size_t offset, size_t count) const {
+    static_assert(std::is_trivially_copyable_v<T>, "only plain data can be read from a file");
+    if (offset > Size() || count > (Size() - offset) / sizeof(T)) {
+        throw std::out_of_range("slice does not fit into the mapped file");
+    }
+    const char* begin = Data() + offset;
+    if (reinterpret_cast<uintptr_t>(begin) % alignof(T) != 0) {
+        throw std::invalid_argument("slice is misaligned for its element type");
+    }
+    return SharedPtr<const T>(region_, reinterpret_cast<const T*>(begin));
+}
+inline bool MappedFile::Advise(MappedAdvice advice) const {
+    return Advise(advice, 0, Size());
+}
+inline bool MappedFile::Advise(MappedAdvice advice, size_t offset, size_t length) const {
+    if (offset >= Size() || length == 0) {
+        return true;
+    }
+    if (length > Size() - offset) {
+        length = Size() - offset;
+    }
+    int native = MADV_NORMAL;
+    switch (advice) {
+        case MappedAdvice::kNormal:
+            native = MADV_NORMAL;
+            break;
+        case MappedAdvice::kSequential:
+            native = MADV_SEQUENTIAL;
+            break;
+        case MappedAdvice::kRandom:
+            native = MADV_RANDOM;
+            break;
+        case MappedAdvice::kWillNeed:
+            native = MADV_WILLNEED;
+            break;
+        case MappedAdvice::kDontNeed:
+            native = MADV_DONTNEED;
+            break;
+        case MappedAdvice::kHugePage:
+#ifdef MADV_HUGEPAGE
+            native = MADV_HUGEPAGE;
+            break;
+#else
+            return false;
+#endif
+    }
+    // `madvise` wants a page-aligned start
+    static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t start = offset / page_size * page_size;
+    return madvise(const_cast<char*>(Data()) + start, length + (offset - start), native) == 0;
+}
@@ -0,0 +1,154 @@
+// Snapshot, update and iteration throughput of the persistent structures against copying
+// `std::vector` and `std::unordered_map`, which is what keeping a snapshot costs with them. An
+// update keeps the previous version alive, as a versioned state engine would. Not part of any
+// build:
+//     g++ -std=c++17 -O2 persistent/bench.cpp -o persistent-bench && ./persistent-bench
+
+#include "hash_map.h"
+#include "vector.h"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+constexpr int kVectorSize = 1 << 20;
+constexpr int kMapSize = 1 << 17;
+constexpr int kSnapshots = 100;
+constexpr int kUpdates = 100000;
+
+template <typename F>
+double Nanoseconds(F f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start)
+        .count();
+}
+
+void Report(const char* what, double standard, double persistent, const char* unit) {
+    std::printf("%-30s std %12.1f %s, persistent %10.1f %s\n", what, standard, unit, persistent,
+                unit);
+}
+
+void BenchVector() {
+    std::vector<int> standard(kVectorSize);
+    auto transient = PersistentVector<int>().ToTransient();
+    for (int i = 0; i < kVectorSize; ++i) {
+        standard[i] = i;
+        transient.PushBack(i);
+    }
+    PersistentVector<int> persistent = transient.Persistent();
+    std::mt19937 random(1);
+    long sink = 0;
+
+    double standard_snapshot = Nanoseconds([&] {
+        for (int i = 0; i < kSnapshots; ++i) {
+            std::vector<int> snapshot = standard;
+            sink += snapshot[i];
+        }
+    });
+    double persistent_snapshot = Nanoseconds([&] {
+        for (int i = 0; i < kSnapshots; ++i) {
+            PersistentVector<int> snapshot = persistent;
+            sink += snapshot[i];
+        }
+    });
+    Report("vector<int> 1M, snapshot", standard_snapshot / kSnapshots,
+           persistent_snapshot / kSnapshots, "ns");
+
+    // Every std update copies to keep the old version, so far fewer of them are timed
+    double standard_update = Nanoseconds([&] {
+        for (int i = 0; i < kSnapshots; ++i) {
+            std::vector<int> next = standard;
+            next[random() % kVectorSize] = i;
+            standard.swap(next);
+        }
+    });
+    double persistent_update = Nanoseconds([&] {
+        for (int i = 0; i < kUpdates; ++i) {
+            persistent = persistent.Set(random() % kVectorSize, i);
+        }
+    });
+    Report("vector<int> 1M, update", standard_update / kSnapshots,
+           persistent_update / kUpdates, "ns");
+
+    double standard_iteration = Nanoseconds([&] {
+        for (int value : standard) {
+            sink += value;
+        }
+    });
+    double persistent_iteration = Nanoseconds([&] {
+        persistent.ForEach([&](int value) { sink += value; });
+    });
+    Report("vector<int> 1M, iteration", standard_iteration / kVectorSize,
+           persistent_iteration / kVectorSize, "ns/element");
+    if (sink == 0) {
+        std::printf("unreachable\n");
+    }
+}
+
+void BenchMap() {
+    std::unordered_map<int, int> standard;
+    auto transient = PersistentHashMap<int, int>().ToTransient();
+    for (int i = 0; i < kMapSize; ++i) {
+        standard.emplace(i, i);
+        transient.Set(i, i);
+    }
+    PersistentHashMap<int, int> persistent = transient.Persistent();
+    std::mt19937 random(1);
+    long sink = 0;
+
+    double standard_snapshot = Nanoseconds([&] {
+        for (int i = 0; i < kSnapshots; ++i) {
+            std::unordered_map<int, int> snapshot = standard;
+            sink += static_cast<long>(snapshot.size());
+        }
+    });
+    double persistent_snapshot = Nanoseconds([&] {
+        for (int i = 0; i < kSnapshots; ++i) {
+            PersistentHashMap<int, int> snapshot = persistent;
+            sink += static_cast<long>(snapshot.Size());
+        }
+    });
+    Report("unordered_map 128K, snapshot", standard_snapshot / kSnapshots,
+           persistent_snapshot / kSnapshots, "ns");
+
+    double standard_update = Nanoseconds([&] {
+        for (int i = 0; i < kSnapshots; ++i) {
+            std::unordered_map<int, int> next = standard;
+            next[static_cast<int>(random() % kMapSize)] = i;
+            standard.swap(next);
+        }
+    });
+    double persistent_update = Nanoseconds([&] {
+        for (int i = 0; i < kUpdates; ++i) {
+            persistent = persistent.Set(static_cast<int>(random() % kMapSize), i);
+        }
+    });
+    Report("unordered_map 128K, update", standard_update / kSnapshots,
+           persistent_update / kUpdates, "ns");
+
+    double standard_iteration = Nanoseconds([&] {
+        for (const auto& [key, value] : standard) {
+            sink += key + value;
+        }
+    });
+    double persistent_iteration = Nanoseconds([&] {
+        persistent.ForEach([&](int key, int value) { sink += key + value; });
+    });
+    Report("unordered_map 128K, iteration", standard_iteration / kMapSize,
+           persistent_iteration / kMapSize, "ns/entry");
+    if (sink == 0) {
+        std::printf("unreachable\n");
+    }
+}
+
+}  // namespace
+
+int main() {
+    BenchVector();
+    BenchMap();
+}
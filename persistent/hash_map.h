@@ -0,0 +1,351 @@
+#pragma once
+
+#include "trie.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <vector>
+
+// Immutable hash map as a hash array mapped trie: each node spends 5 bits of the hash on 32
+// slots, and bitmaps record which slots hold an entry and which a child, so nodes only store what
+// is there. Updates copy the O(log32 n) nodes on the key's path and share the rest; erasing
+// pulls lone entries back up to keep paths short. Keys whose whole hash collides share a node at
+// the bottom that is searched linearly.
+//
+// `Transient` batches updates in place, as for `PersistentVector`, and the same thread rule holds,
+// for the same reason: its counts are not atomic either.
+template <typename K, typename V, typename Hash = std::hash<K>, typename Equal = std::equal_to<K>>
+class PersistentHashMap {
+    struct Node : RefCounted<Node, SimpleCounter, DefaultDelete> {
+        uint32_t data_map = 0;  // Slots holding an entry
+        uint32_t node_map = 0;  // Slots holding a child
+        // Ordered by slot; below the last level, unordered colliding entries and no children
+        std::vector<std::pair<K, V>> entries;
+        std::vector<IntrusivePtr<Node>> children;
+    };
+
+public:
+    class Transient;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    PersistentHashMap();
+    PersistentHashMap(const PersistentHashMap& other) = default;
+    PersistentHashMap(PersistentHashMap&& other) noexcept;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    PersistentHashMap& operator=(const PersistentHashMap& other) = default;
+    PersistentHashMap& operator=(PersistentHashMap&& other) noexcept;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Updates, each returning a new version
+
+    // Inserts `key` or replaces its value
+    PersistentHashMap Set(K key, V value) const;
+    PersistentHashMap Erase(const K& key) const;
+    Transient ToTransient() const;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    // `nullptr` if `key` is absent
+    const V* Find(const K& key) const;
+    bool Contains(const K& key) const;
+    size_t Size() const;
+    bool Empty() const;
+    // Calls `function(key, value)` for every entry, in no particular order
+    template <typename Function>
+    void ForEach(Function&& function) const;
+
+private:
+    static constexpr size_t kHashBits = std::numeric_limits<size_t>::digits;
+
+    static IntrusivePtr<Node> Clone(Node& node);
+    static Node* Own(IntrusivePtr<Node>& slot);
+    static uint32_t SlotBit(size_t hash, size_t shift);
+    static size_t IndexOf(uint32_t map, uint32_t bit);
+
+    // Return whether the entry count changed
+    static bool SetIn(IntrusivePtr<Node>& slot, size_t shift, size_t hash, K&& key, V&& value);
+    static bool EraseIn(IntrusivePtr<Node>& slot, size_t shift, size_t hash, const K& key);
+    template <typename Function>
+    static void ForEachIn(const Node* node, Function& function);
+
+    void SetInPlace(K key, V value);
+    void EraseInPlace(const K& key);
+
+    IntrusivePtr<Node> root_;
+    size_t size_;
+};
+
+// Mutable view of a `PersistentHashMap` for batches of updates, see `PersistentVector::Transient`
+template <typename K, typename V, typename Hash, typename Equal>
+class PersistentHashMap<K, V, Hash, Equal>::Transient {
+public:
+    explicit Transient(PersistentHashMap map);
+
+    void Set(K key, V value);
+    void Erase(const K& key);
+
+    const V* Find(const K& key) const;
+    size_t Size() const;
+
+    // The map built so far; the transient is left empty
+    PersistentHashMap Persistent();
+
+private:
+    PersistentHashMap map_;
+};
+
+template <typename K, typename V, typename Hash, typename Equal>
+PersistentHashMap<K, V, Hash, Equal>::PersistentHashMap() : root_(nullptr), size_(0) {
+}
+template <typename K, typename V, typename Hash, typename Equal>
+PersistentHashMap<K, V, Hash, Equal>::PersistentHashMap(PersistentHashMap&& other) noexcept
+    : root_(std::move(other.root_)), size_(std::exchange(other.size_, 0)) {
+}
+template <typename K, typename V, typename Hash, typename Equal>
+PersistentHashMap<K, V, Hash, Equal>& PersistentHashMap<K, V, Hash, Equal>::operator=(
+    PersistentHashMap&& other) noexcept {
+    if (&other == this) {
+        return *this;
+    }
+    root_ = std::move(other.root_);
+    size_ = std::exchange(other.size_, 0);
+    return *this;
+}
+template <typename K, typename V, typename Hash, typename Equal>
+IntrusivePtr<typename PersistentHashMap<K, V, Hash, Equal>::Node>
+PersistentHashMap<K, V, Hash, Equal>::Clone(Node& node) {
+    IntrusivePtr<Node> copy(new Node);
+    copy->data_map = node.data_map;
+    copy->node_map = node.node_map;
+    copy->entries = node.entries;
+    copy->children = node.children;
+    return copy;
+}
+template <typename K, typename V, typename Hash, typename Equal>
+typename PersistentHashMap<K, V, Hash, Equal>::Node* PersistentHashMap<K, V, Hash, Equal>::Own(
+    IntrusivePtr<Node>& slot) {
+    if (!slot) {
+        slot = new Node;
+        return slot.Get();
+    }
+    return ExclusiveNode(slot, Clone);
+}
+template <typename K, typename V, typename Hash, typename Equal>
+uint32_t PersistentHashMap<K, V, Hash, Equal>::SlotBit(size_t hash, size_t shift) {
+    return uint32_t{1} << ((hash >> shift) & kTrieMask);
+}
+template <typename K, typename V, typename Hash, typename Equal>
+size_t PersistentHashMap<K, V, Hash, Equal>::IndexOf(uint32_t map, uint32_t bit) {
+    return __builtin_popcount(map & (bit - 1));
+}
+template <typename K, typename V, typename Hash, typename Equal>
+bool PersistentHashMap<K, V, Hash, Equal>::SetIn(IntrusivePtr<Node>& slot, size_t shift,
+                                                 size_t hash, K&& key, V&& value) {
+    Node* node = Own(slot);
+    if (shift >= kHashBits) {
+        for (auto& entry : node->entries) {
+            if (Equal()(entry.first, key)) {
+                entry.second = std::move(value);
+                return false;
+            }
+        }
+        node->entries.emplace_back(std::move(key), std::move(value));
+        return true;
+    }
+    uint32_t bit = SlotBit(hash, shift);
+    if (node->node_map & bit) {
+        return SetIn(node->children[IndexOf(node->node_map, bit)], shift + kTrieBits, hash,
+                     std::move(key), std::move(value));
+    }
+    size_t index = IndexOf(node->data_map, bit);
+    if (!(node->data_map & bit)) {
+        node->entries.emplace(node->entries.begin() + index, std::move(key), std::move(value));
+        node->data_map |= bit;
+        return true;
+    }
+    auto& entry = node->entries[index];
+    if (Equal()(entry.first, key)) {
+        entry.second = std::move(value);
+        return false;
+    }
+    // Two keys in one slot: both move down into a new child
+    IntrusivePtr<Node> child;
+    size_t entry_hash = Hash()(entry.first);
+    SetIn(child, shift + kTrieBits, entry_hash, std::move(entry.first), std::move(entry.second));
+    SetIn(child, shift + kTrieBits, hash, std::move(key), std::move(value));
+    node->entries.erase(node->entries.begin() + index);
+    node->data_map &= ~bit;
+    node->children.insert(node->children.begin() + IndexOf(node->node_map, bit), std::move(child));
+    node->node_map |= bit;
+    return true;
+}
+template <typename K, typename V, typename Hash, typename Equal>
+bool PersistentHashMap<K, V, Hash, Equal>::EraseIn(IntrusivePtr<Node>& slot, size_t shift,
+                                                   size_t hash, const K& key) {
+    Node* node = Own(slot);
+    if (shift >= kHashBits) {
+        for (size_t i = 0; i < node->entries.size(); ++i) {
+            if (Equal()(node->entries[i].first, key)) {
+                node->entries.erase(node->entries.begin() + i);
+                return true;
+            }
+        }
+        return false;
+    }
+    uint32_t bit = SlotBit(hash, shift);
+    if (node->data_map & bit) {
+        size_t index = IndexOf(node->data_map, bit);
+        if (!Equal()(node->entries[index].first, key)) {
+            return false;
+        }
+        node->entries.erase(node->entries.begin() + index);
+        node->data_map &= ~bit;
+        return true;
+    }
+    if (!(node->node_map & bit)) {
+        return false;
+    }
+    size_t index = IndexOf(node->node_map, bit);
+    IntrusivePtr<Node>& child = node->children[index];
+    if (!EraseIn(child, shift + kTrieBits, hash, key)) {
+        return false;
+    }
+    // A child down to a single entry and no children is folded back into this node
+    if (child->children.empty() && child->entries.size() <= 1) {
+        if (child->entries.size() == 1) {
+            size_t data_index = IndexOf(node->data_map, bit);
+            node->entries.insert(node->entries.begin() + data_index,
+                                 std::move(child->entries.front()));
+            node->data_map |= bit;
+        }
+        node->children.erase(node->children.begin() + index);
+        node->node_map &= ~bit;
+    }
+    return true;
+}
+template <typename K, typename V, typename Hash, typename Equal>
+void PersistentHashMap<K, V, Hash, Equal>::SetInPlace(K key, V value) {
+    size_t hash = Hash()(key);
+    if (SetIn(root_, 0, hash, std::move(key), std::move(value))) {
+        ++size_;
+    }
+}
+template <typename K, typename V, typename Hash, typename Equal>
+void PersistentHashMap<K, V, Hash, Equal>::EraseInPlace(const K& key) {
+    // Checked first so that erasing an absent key copies nothing
+    if (!Contains(key)) {
+        return;
+    }
+    EraseIn(root_, 0, Hash()(key), key);
+    if (--size_ == 0) {
+        root_.Reset();
+    }
+}
+template <typename K, typename V, typename Hash, typename Equal>
+PersistentHashMap<K, V, Hash, Equal> PersistentHashMap<K, V, Hash, Equal>::Set(K key,
+                                                                               V value) const {
+    PersistentHashMap result = *this;
+    result.SetInPlace(std::move(key), std::move(value));
+    return result;
+}
+template <typename K, typename V, typename Hash, typename Equal>
+PersistentHashMap<K, V, Hash, Equal> PersistentHashMap<K, V, Hash, Equal>::Erase(
+    const K& key) const {
+    PersistentHashMap result = *this;
+    result.EraseInPlace(key);
+    return result;
+}
+template <typename K, typename V, typename Hash, typename Equal>
+typename PersistentHashMap<K, V, Hash, Equal>::Transient
+PersistentHashMap<K, V, Hash, Equal>::ToTransient() const {
+    return Transient(*this);
+}
+template <typename K, typename V, typename Hash, typename Equal>
+const V* PersistentHashMap<K, V, Hash, Equal>::Find(const K& key) const {
+    size_t hash = Hash()(key);
+    const Node* node = root_.Get();
+    for (size_t shift = 0; node; shift += kTrieBits) {
+        if (shift >= kHashBits) {
+            for (const auto& entry : node->entries) {
+                if (Equal()(entry.first, key)) {
+                    return &entry.second;
+                }
+            }
+            return nullptr;
+        }
+        uint32_t bit = SlotBit(hash, shift);
+        if (node->data_map & bit) {
+            const auto& entry = node->entries[IndexOf(node->data_map, bit)];
+            return Equal()(entry.first, key) ? &entry.second : nullptr;
+        }
+        if (!(node->node_map & bit)) {
+            return nullptr;
+        }
+        node = node->children[IndexOf(node->node_map, bit)].Get();
+    }
+    return nullptr;
+}
+template <typename K, typename V, typename Hash, typename Equal>
+bool PersistentHashMap<K, V, Hash, Equal>::Contains(const K& key) const {
+    return Find(key) != nullptr;
+}
+template <typename K, typename V, typename Hash, typename Equal>
+size_t PersistentHashMap<K, V, Hash, Equal>::Size() const {
+    return size_;
+}
+template <typename K, typename V, typename Hash, typename Equal>
+bool PersistentHashMap<K, V, Hash, Equal>::Empty() const {
+    return size_ == 0;
+}
+template <typename K, typename V, typename Hash, typename Equal>
+template <typename Function>
+void PersistentHashMap<K, V, Hash, Equal>::ForEach(Function&& function) const {
+    if (root_) {
+        ForEachIn(root_.Get(), function);
+    }
+}
+template <typename K, typename V, typename Hash, typename Equal>
+template <typename Function>
+void PersistentHashMap<K, V, Hash, Equal>::ForEachIn(const Node* node, Function& function) {
+    for (const auto& entry : node->entries) {
+        function(entry.first, entry.second);
+    }
+    for (const auto& child : node->children) {
+        ForEachIn(child.Get(), function);
+    }
+}
+
+template <typename K, typename V, typename Hash, typename Equal>
+PersistentHashMap<K, V, Hash, Equal>::Transient::Transient(PersistentHashMap map)
+    : map_(std::move(map)) {
+}
+template <typename K, typename V, typename Hash, typename Equal>
+void PersistentHashMap<K, V, Hash, Equal>::Transient::Set(K key, V value) {
+    map_.SetInPlace(std::move(key), std::move(value));
+}
+template <typename K, typename V, typename Hash, typename Equal>
+void PersistentHashMap<K, V, Hash, Equal>::Transient::Erase(const K& key) {
+    map_.EraseInPlace(key);
+}
+template <typename K, typename V, typename Hash, typename Equal>
+const V* PersistentHashMap<K, V, Hash, Equal>::Transient::Find(const K& key) const {
+    return map_.Find(key);
+}
+template <typename K, typename V, typename Hash, typename Equal>
+size_t PersistentHashMap<K, V, Hash, Equal>::Transient::Size() const {
+    return map_.Size();
+}
+template <typename K, typename V, typename Hash, typename Equal>
+PersistentHashMap<K, V, Hash, Equal>
+PersistentHashMap<K, V, Hash, Equal>::Transient::Persistent() {
+    return std::move(map_);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "../intrusive/intrusive.h"
+
+#include <cstddef>
+
+// Both persistent structures are 32-way tries consuming 5 bits of an index or hash per level
+inline constexpr size_t kTrieBits = 5;
+inline constexpr size_t kTrieWidth = size_t{1} << kTrieBits;
+inline constexpr size_t kTrieMask = kTrieWidth - 1;
+
+// Makes `node` safe to mutate in place: nodes referenced from elsewhere (a snapshot, another
+// version) are replaced by a `clone` first. Walking down from the root this way copies exactly
+// the shared part of the path, since the copy of a parent is what makes its children shared.
+template <typename Node, typename Clone>
+Node* ExclusiveNode(IntrusivePtr<Node>& node, Clone clone) {
+    if (node->RefCount() != 1) {
+        node = clone(*node);
+    }
+    return node.Get();
+}
@@ -0,0 +1,358 @@
+#pragma once
+
+#include "trie.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+// Immutable vector: every update returns a new version sharing all but O(log32 n) nodes with
+// the old one, so keeping a snapshot is a copy of the root pointer. Elements sit in leaves of 32
+// below a dense radix trie of `IntrusivePtr`-linked inner nodes.
+//
+// `Transient` batches updates: it mutates in place every node nothing else references and copies
+// the rest, once. Versions share nodes through non-atomic counts, so a vector and all versions
+// derived from it must stay on one thread (or be handed over as a whole).
+//
+// The counts are `SimpleCounter`s on purpose: an update changes the counts of up to 32 children
+// for every node it copies, and a snapshot dropped releases whole subtrees, so atomic counts
+// would put a locked instruction on each of those. Versions meant for other threads can be
+// rebuilt there from `ForEach`, or guarded by a lock around the whole family of versions.
+template <typename T>
+class PersistentVector {
+    struct Node;
+    struct NodeDelete {
+        static void Destroy(Node* node);
+    };
+    struct Node : RefCounted<Node, SimpleCounter, NodeDelete> {
+        explicit Node(bool leaf) : is_leaf(leaf), count(0) {
+        }
+
+        bool is_leaf;
+        uint8_t count;  // Children or elements in use, always a prefix
+    };
+    struct Inner : Node {
+        Inner() : Node(false) {
+        }
+
+        IntrusivePtr<Node> children[kTrieWidth];
+    };
+    struct Leaf : Node {
+        Leaf() : Node(true) {
+        }
+        ~Leaf() {
+            for (size_t i = this->count; i > 0; --i) {
+                Values()[i - 1].~T();
+            }
+        }
+        T* Values() {
+            return reinterpret_cast<T*>(storage);
+        }
+        const T* Values() const {
+            return reinterpret_cast<const T*>(storage);
+        }
+
+        std::aligned_storage_t<sizeof(T), alignof(T)> storage[kTrieWidth];
+    };
+
+public:
+    class Transient;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    PersistentVector();
+    PersistentVector(const PersistentVector& other) = default;
+    PersistentVector(PersistentVector&& other) noexcept;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    PersistentVector& operator=(const PersistentVector& other) = default;
+    PersistentVector& operator=(PersistentVector&& other) noexcept;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Updates, each returning a new version
+
+    PersistentVector PushBack(T value) const;
+    PersistentVector Set(size_t index, T value) const;
+    // Throws `std::out_of_range` if the vector is empty
+    PersistentVector PopBack() const;
+    Transient ToTransient() const;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    const T& operator[](size_t index) const;
+    // Throws `std::out_of_range` past the end
+    const T& At(size_t index) const;
+    size_t Size() const;
+    bool Empty() const;
+    // Calls `function(element)` in order, a leaf at a time
+    template <typename Function>
+    void ForEach(Function&& function) const;
+
+private:
+    static IntrusivePtr<Node> Clone(Node& node);
+    // `slot` made exclusive, or created if null; `shift` tells which kind of node belongs there
+    static Node* Own(IntrusivePtr<Node>& slot, size_t shift);
+    // Returns `true` if the node under `slot` was left empty
+    static bool PopFrom(IntrusivePtr<Node>& slot, size_t shift);
+    template <typename Function>
+    static void ForEachIn(const Node* node, Function& function);
+
+    // Mutations behind both the persistent updates and `Transient`
+    void PushBackInPlace(T value);
+    void SetInPlace(size_t index, T value);
+    void PopBackInPlace();
+
+    IntrusivePtr<Node> root_;
+    size_t size_;
+    size_t shift_;  // Index bits below the root; zero when the root is a leaf
+};
+
+// Mutable view of a `PersistentVector` for batches of updates. Nodes it has copied or created are
+// referenced by nothing else and are updated in place from then on; `Persistent()` seals them.
+template <typename T>
+class PersistentVector<T>::Transient {
+public:
+    explicit Transient(PersistentVector vector);
+
+    void PushBack(T value);
+    void Set(size_t index, T value);
+    void PopBack();
+
+    const T& operator[](size_t index) const;
+    size_t Size() const;
+
+    // The vector built so far; the transient is left empty
+    PersistentVector Persistent();
+
+private:
+    PersistentVector vector_;
+};
+
+template <typename T>
+void PersistentVector<T>::NodeDelete::Destroy(Node* node) {
+    if (node->is_leaf) {
+        delete static_cast<Leaf*>(node);
+    } else {
+        delete static_cast<Inner*>(node);
+    }
+}
+template <typename T>
+PersistentVector<T>::PersistentVector() : root_(nullptr), size_(0), shift_(0) {
+}
+template <typename T>
+PersistentVector<T>::PersistentVector(PersistentVector&& other) noexcept
+    : root_(std::move(other.root_)),
+      size_(std::exchange(other.size_, 0)),
+      shift_(std::exchange(other.shift_, 0)) {
+}
+template <typename T>
+PersistentVector<T>& PersistentVector<T>::operator=(PersistentVector&& other) noexcept {
+    if (&other == this) {
+        return *this;
+    }
+    root_ = std::move(other.root_);
+    size_ = std::exchange(other.size_, 0);
+    shift_ = std::exchange(other.shift_, 0);
+    return *this;
+}
+template <typename T>
+IntrusivePtr<typename PersistentVector<T>::Node> PersistentVector<T>::Clone(Node& node) {
+    if (node.is_leaf) {
+        auto& leaf = static_cast<Leaf&>(node);
+        IntrusivePtr<Leaf> copy(new Leaf);
+        // `count` follows the constructed prefix, so a throwing copy leaves a valid leaf behind
+        for (; copy->count < leaf.count; ++copy->count) {
+            new (copy->Values() + copy->count) T(leaf.Values()[copy->count]);
+        }
+        return copy;
+    }
+    auto& inner = static_cast<Inner&>(node);
+    IntrusivePtr<Inner> copy(new Inner);
+    for (size_t i = 0; i < inner.count; ++i) {
+        copy->children[i] = inner.children[i];
+    }
+    copy->count = inner.count;
+    return copy;
+}
+template <typename T>
+typename PersistentVector<T>::Node* PersistentVector<T>::Own(IntrusivePtr<Node>& slot,
+                                                             size_t shift) {
+    if (!slot) {
+        slot = shift ? static_cast<Node*>(new Inner) : static_cast<Node*>(new Leaf);
+        return slot.Get();
+    }
+    return ExclusiveNode(slot, Clone);
+}
+template <typename T>
+void PersistentVector<T>::PushBackInPlace(T value) {
+    if (root_ && size_ == size_t{1} << (shift_ + kTrieBits)) {
+        // The trie is full: the old root becomes the first child of a new one
+        IntrusivePtr<Node> root(new Inner);
+        static_cast<Inner*>(root.Get())->children[0] = std::move(root_);
+        root->count = 1;
+        root_ = std::move(root);
+        shift_ += kTrieBits;
+    }
+    Node* node = Own(root_, shift_);
+    for (size_t shift = shift_; shift > 0; shift -= kTrieBits) {
+        auto inner = static_cast<Inner*>(node);
+        size_t index = (size_ >> shift) & kTrieMask;
+        node = Own(inner->children[index], shift - kTrieBits);
+        if (index == inner->count) {
+            ++inner->count;
+        }
+    }
+    auto leaf = static_cast<Leaf*>(node);
+    new (leaf->Values() + leaf->count) T(std::move(value));
+    ++leaf->count;
+    ++size_;
+}
+template <typename T>
+void PersistentVector<T>::SetInPlace(size_t index, T value) {
+    if (index >= size_) {
+        throw std::out_of_range("PersistentVector: index out of range");
+    }
+    Node* node = Own(root_, shift_);
+    for (size_t shift = shift_; shift > 0; shift -= kTrieBits) {
+        node = Own(static_cast<Inner*>(node)->children[(index >> shift) & kTrieMask],
+                   shift - kTrieBits);
+    }
+    static_cast<Leaf*>(node)->Values()[index & kTrieMask] = std::move(value);
+}
+template <typename T>
+bool PersistentVector<T>::PopFrom(IntrusivePtr<Node>& slot, size_t shift) {
+    // The trie is dense, so the last element is always under the last child
+    Node* node = Own(slot, shift);
+    if (shift == 0) {
+        auto leaf = static_cast<Leaf*>(node);
+        leaf->Values()[--leaf->count].~T();
+    } else {
+        auto inner = static_cast<Inner*>(node);
+        IntrusivePtr<Node>& child = inner->children[inner->count - 1];
+        if (PopFrom(child, shift - kTrieBits)) {
+            child.Reset();
+            --inner->count;
+        }
+    }
+    return node->count == 0;
+}
+template <typename T>
+void PersistentVector<T>::PopBackInPlace() {
+    if (size_ == 0) {
+        throw std::out_of_range("PersistentVector: PopBack on an empty vector");
+    }
+    PopFrom(root_, shift_);
+    if (--size_ == 0) {
+        root_.Reset();
+        shift_ = 0;
+        return;
+    }
+    while (shift_ > 0 && root_->count == 1) {
+        // Taken out before the old root, which holds the last reference to it, goes away
+        IntrusivePtr<Node> child = static_cast<Inner*>(root_.Get())->children[0];
+        root_ = std::move(child);
+        shift_ -= kTrieBits;
+    }
+}
+template <typename T>
+PersistentVector<T> PersistentVector<T>::PushBack(T value) const {
+    PersistentVector result = *this;
+    result.PushBackInPlace(std::move(value));
+    return result;
+}
+template <typename T>
+PersistentVector<T> PersistentVector<T>::Set(size_t index, T value) const {
+    PersistentVector result = *this;
+    result.SetInPlace(index, std::move(value));
+    return result;
+}
+template <typename T>
+PersistentVector<T> PersistentVector<T>::PopBack() const {
+    PersistentVector result = *this;
+    result.PopBackInPlace();
+    return result;
+}
+template <typename T>
+typename PersistentVector<T>::Transient PersistentVector<T>::ToTransient() const {
+    return Transient(*this);
+}
+template <typename T>
+const T& PersistentVector<T>::operator[](size_t index) const {
+    const Node* node = root_.Get();
+    for (size_t shift = shift_; shift > 0; shift -= kTrieBits) {
+        node = static_cast<const Inner*>(node)->children[(index >> shift) & kTrieMask].Get();
+    }
+    return static_cast<const Leaf*>(node)->Values()[index & kTrieMask];
+}
+template <typename T>
+const T& PersistentVector<T>::At(size_t index) const {
+    if (index >= size_) {
+        throw std::out_of_range("PersistentVector: index out of range");
+    }
+    return (*this)[index];
+}
+template <typename T>
+size_t PersistentVector<T>::Size() const {
+    return size_;
+}
+template <typename T>
+bool PersistentVector<T>::Empty() const {
+    return size_ == 0;
+}
+template <typename T>
+template <typename Function>
+void PersistentVector<T>::ForEach(Function&& function) const {
+    if (root_) {
+        ForEachIn(root_.Get(), function);
+    }
+}
+template <typename T>
+template <typename Function>
+void PersistentVector<T>::ForEachIn(const Node* node, Function& function) {
+    if (node->is_leaf) {
+        const T* values = static_cast<const Leaf*>(node)->Values();
+        for (size_t i = 0; i < node->count; ++i) {
+            function(values[i]);
+        }
+        return;
+    }
+    auto inner = static_cast<const Inner*>(node);
+    for (size_t i = 0; i < node->count; ++i) {
+        ForEachIn(inner->children[i].Get(), function);
+    }
+}
+
+template <typename T>
+PersistentVector<T>::Transient::Transient(PersistentVector vector) : vector_(std::move(vector)) {
+}
+template <typename T>
+void PersistentVector<T>::Transient::PushBack(T value) {
+    vector_.PushBackInPlace(std::move(value));
+}
+template <typename T>
+void PersistentVector<T>::Transient::Set(size_t index, T value) {
+    vector_.SetInPlace(index, std::move(value));
+}
+template <typename T>
+void PersistentVector<T>::Transient::PopBack() {
+    vector_.PopBackInPlace();
+}
+template <typename T>
+const T& PersistentVector<T>::Transient::operator[](size_t index) const {
+    return vector_[index];
+}
+template <typename T>
+size_t PersistentVector<T>::Transient::Size() const {
+    return vector_.Size();
+}
+template <typename T>
+PersistentVector<T> PersistentVector<T>::Transient::Persistent() {
+    return std::move(vector_);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>  // std::less
+#include <type_traits>
+
+// Owner-based comparison of smart pointers, as with `std::owner_less`: pointers are equal when
+// they share ownership of the same object, whatever they point at (aliasing) and whether the
+// object is still alive (expired `WeakPtr`s keep their identity as long as they hold the block).
+// Raw pointers are their own owners.
+
+template <typename P>
+const void* OwnerAddress(const P& ptr) {
+    if constexpr (std::is_pointer_v<P>) {
+        return ptr;
+    } else {
+        return ptr.OwnerId();
+    }
+}
+
+#ifdef __SIZEOF_INT128__
+// `__extension__` keeps `-Wpedantic` quiet about the non-standard type
+__extension__ using PointerHashProduct = unsigned __int128;
+#endif
+
+// Control blocks and heap objects are at least 16-byte aligned, so the low bits carry no
+// entropy; what is left goes through a 64x64->128 multiply whose halves are folded together.
+inline uint64_t PointerHash(const void* ptr) {
+    uint64_t x = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(ptr)) >> 4;
+#ifdef __SIZEOF_INT128__
+    PointerHashProduct product = static_cast<PointerHashProduct>(x) * 0x9E3779B97F4A7C15;
+    return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+#else
+    x *= 0x9E3779B97F4A7C15;
+    return x ^ (x >> 32);
+#endif
+}
+
+struct OwnerHash {
+    template <typename P>
+    size_t operator()(const P& ptr) const {
+        return PointerHash(OwnerAddress(ptr));
+    }
+};
+
+struct OwnerEqual {
+    template <typename P, typename Q>
+    bool operator()(const P& left, const Q& right) const {
+        return OwnerAddress(left) == OwnerAddress(right);
+    }
+};
+
+struct OwnerLess {
+    template <typename P, typename Q>
+    bool operator()(const P& left, const Q& right) const {
+        return std::less<const void*>()(OwnerAddress(left), OwnerAddress(right));
+    }
+};
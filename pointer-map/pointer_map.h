@@ -0,0 +1,374 @@
+#pragma once
+
+#include "owner.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>  // std::memset
+#include <new>
+#include <utility>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+inline constexpr size_t kPointerMapGroupSize = 16;
+
+// Control byte per slot: negative for free slots, otherwise the low 7 bits of the key's hash
+inline constexpr int8_t kPointerMapEmpty = -128;
+inline constexpr int8_t kPointerMapDeleted = -2;
+
+// Sixteen control bytes examined at once: every `Match*` returns a mask with bit `i` set for each
+// matching byte `i`. One SSE2 compare per group, a plain loop where SSE2 is unavailable.
+class PointerMapGroup {
+public:
+    explicit PointerMapGroup(const int8_t* ctrl);
+
+    uint32_t Match(int8_t fragment) const;
+    uint32_t MatchEmpty() const;
+    uint32_t MatchFree() const;
+
+private:
+#ifdef __SSE2__
+    __m128i ctrl_;
+#else
+    const int8_t* ctrl_;
+#endif
+};
+#ifdef __SSE2__
+inline PointerMapGroup::PointerMapGroup(const int8_t* ctrl)
+    : ctrl_(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl))) {
+}
+inline uint32_t PointerMapGroup::Match(int8_t fragment) const {
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(fragment), ctrl_));
+}
+inline uint32_t PointerMapGroup::MatchEmpty() const {
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(kPointerMapEmpty), ctrl_));
+}
+inline uint32_t PointerMapGroup::MatchFree() const {
+    // Free bytes are exactly the ones with the sign bit set
+    return _mm_movemask_epi8(ctrl_);
+}
+#else
+inline PointerMapGroup::PointerMapGroup(const int8_t* ctrl) : ctrl_(ctrl) {
+}
+inline uint32_t PointerMapGroup::Match(int8_t fragment) const {
+    uint32_t mask = 0;
+    for (size_t i = 0; i < kPointerMapGroupSize; ++i) {
+        mask |= static_cast<uint32_t>(ctrl_[i] == fragment) << i;
+    }
+    return mask;
+}
+inline uint32_t PointerMapGroup::MatchEmpty() const {
+    return Match(kPointerMapEmpty);
+}
+inline uint32_t PointerMapGroup::MatchFree() const {
+    uint32_t mask = 0;
+    for (size_t i = 0; i < kPointerMapGroupSize; ++i) {
+        mask |= static_cast<uint32_t>(ctrl_[i] < 0) << i;
+    }
+    return mask;
+}
+#endif
+
+// Flat open-addressing map keyed by pointer identity: raw pointers, or smart pointers compared
+// by owner (see owner.h), so a `WeakPtr` key can still be found and erased after its object died.
+// Laid out like a Swiss table: a control byte per slot holding 7 bits of the hash, probed a group
+// of sixteen at a time, groups visited in triangular order. Keys and values live inline; pointers
+// to values are invalidated by insertions that grow the table.
+template <typename K, typename V>
+class PointerMap {
+public:
+    PointerMap();
+    PointerMap(PointerMap&& other) noexcept;
+    PointerMap& operator=(PointerMap&& other) noexcept;
+    PointerMap(const PointerMap& other) = delete;
+    PointerMap& operator=(const PointerMap& other) = delete;
+    ~PointerMap();
+
+    // Lookups take anything sharing ownership with the key, e.g. a `SharedPtr` in a map keyed by
+    // `WeakPtr`s
+    template <typename Q>
+    V* Find(const Q& key);
+    template <typename Q>
+    const V* Find(const Q& key) const;
+    template <typename Q>
+    bool Contains(const Q& key) const;
+
+    // The value stored for `key`, after inserting `value` if there was none; `second` tells
+    // whether it was inserted
+    std::pair<V*, bool> Insert(const K& key, V value);
+    V& operator[](const K& key);
+    template <typename Q>
+    bool Erase(const Q& key);
+    // Erases every entry for which `predicate(key, value)` holds, e.g. expired `WeakPtr` keys
+    template <typename Predicate>
+    size_t EraseIf(Predicate&& predicate);
+    template <typename Function>
+    void ForEach(Function&& function);
+
+    void Reserve(size_t size);
+    void Clear();
+
+    size_t Size() const;
+    bool Empty() const;
+    size_t Capacity() const;
+
+private:
+    struct Slot {
+        K key;
+        V value;
+    };
+
+    static size_t GroupIndex(uint64_t hash);
+    static int8_t Fragment(uint64_t hash);
+    static size_t MaxLoad(size_t capacity);
+
+    // Index of the slot holding `owner`, or `capacity_` if there is none
+    size_t FindIndex(const void* owner, uint64_t hash) const;
+    // Index of a free slot for a key known to be absent
+    size_t FindFree(uint64_t hash) const;
+    void EraseAt(size_t index);
+    void Resize(size_t capacity);
+    void Destroy();
+
+    int8_t* ctrl_;
+    Slot* slots_;
+    size_t capacity_;  // Zero or a power of two, at least a group
+    size_t size_;
+    size_t growth_left_;  // Empty (not deleted) slots that may still be filled before a rehash
+};
+template <typename K, typename V>
+PointerMap<K, V>::PointerMap()
+    : ctrl_(nullptr), slots_(nullptr), capacity_(0), size_(0), growth_left_(0) {
+}
+template <typename K, typename V>
+PointerMap<K, V>::PointerMap(PointerMap&& other) noexcept
+    : ctrl_(std::exchange(other.ctrl_, nullptr)),
+      slots_(std::exchange(other.slots_, nullptr)),
+      capacity_(std::exchange(other.capacity_, 0)),
+      size_(std::exchange(other.size_, 0)),
+      growth_left_(std::exchange(other.growth_left_, 0)) {
+}
+template <typename K, typename V>
+PointerMap<K, V>& PointerMap<K, V>::operator=(PointerMap&& other) noexcept {
+    if (&other == this) {
+        return *this;
+    }
+    Destroy();
+    ctrl_ = std::exchange(other.ctrl_, nullptr);
+    slots_ = std::exchange(other.slots_, nullptr);
+    capacity_ = std::exchange(other.capacity_, 0);
+    size_ = std::exchange(other.size_, 0);
+    growth_left_ = std::exchange(other.growth_left_, 0);
+    return *this;
+}
+template <typename K, typename V>
+PointerMap<K, V>::~PointerMap() {
+    Destroy();
+}
+template <typename K, typename V>
+size_t PointerMap<K, V>::GroupIndex(uint64_t hash) {
+    return static_cast<size_t>(hash >> 7);
+}
+template <typename K, typename V>
+int8_t PointerMap<K, V>::Fragment(uint64_t hash) {
+    return static_cast<int8_t>(hash & 0x7F);
+}
+template <typename K, typename V>
+size_t PointerMap<K, V>::MaxLoad(size_t capacity) {
+    return capacity - capacity / 8;
+}
+template <typename K, typename V>
+size_t PointerMap<K, V>::FindIndex(const void* owner, uint64_t hash) const {
+    if (capacity_ == 0) {
+        return capacity_;
+    }
+    size_t group_mask = capacity_ / kPointerMapGroupSize - 1;
+    size_t group = GroupIndex(hash) & group_mask;
+    for (size_t step = 1;; ++step) {
+        size_t base = group * kPointerMapGroupSize;
+        PointerMapGroup ctrl(ctrl_ + base);
+        for (uint32_t mask = ctrl.Match(Fragment(hash)); mask; mask &= mask - 1) {
+            size_t index = base + __builtin_ctz(mask);
+            if (OwnerAddress(slots_[index].key) == owner) {
+                return index;
+            }
+        }
+        if (ctrl.MatchEmpty() || step > group_mask) {
+            return capacity_;
+        }
+        group = (group + step) & group_mask;
+    }
+}
+template <typename K, typename V>
+size_t PointerMap<K, V>::FindFree(uint64_t hash) const {
+    size_t group_mask = capacity_ / kPointerMapGroupSize - 1;
+    size_t group = GroupIndex(hash) & group_mask;
+    // The load limit guarantees a free slot somewhere, and triangular steps visit every group
+    for (size_t step = 1;; ++step) {
+        size_t base = group * kPointerMapGroupSize;
+        if (uint32_t mask = PointerMapGroup(ctrl_ + base).MatchFree()) {
+            return base + __builtin_ctz(mask);
+        }
+        group = (group + step) & group_mask;
+    }
+}
+template <typename K, typename V>
+template <typename Q>
+V* PointerMap<K, V>::Find(const Q& key) {
+    const void* owner = OwnerAddress(key);
+    size_t index = FindIndex(owner, PointerHash(owner));
+    return index == capacity_ ? nullptr : &slots_[index].value;
+}
+template <typename K, typename V>
+template <typename Q>
+const V* PointerMap<K, V>::Find(const Q& key) const {
+    const void* owner = OwnerAddress(key);
+    size_t index = FindIndex(owner, PointerHash(owner));
+    return index == capacity_ ? nullptr : &slots_[index].value;
+}
+template <typename K, typename V>
+template <typename Q>
+bool PointerMap<K, V>::Contains(const Q& key) const {
+    return Find(key) != nullptr;
+}
+template <typename K, typename V>
+std::pair<V*, bool> PointerMap<K, V>::Insert(const K& key, V value) {
+    const void* owner = OwnerAddress(key);
+    uint64_t hash = PointerHash(owner);
+    size_t index = FindIndex(owner, hash);
+    if (index != capacity_) {
+        return {&slots_[index].value, false};
+    }
+    if (growth_left_ == 0) {
+        // Grow if the table is really full, otherwise just flush the tombstones
+        Resize(capacity_ == 0 ? kPointerMapGroupSize
+                              : (size_ >= MaxLoad(capacity_) / 2 ? capacity_ * 2 : capacity_));
+    }
+    index = FindFree(hash);
+    new (&slots_[index]) Slot{key, std::move(value)};
+    growth_left_ -= ctrl_[index] == kPointerMapEmpty;
+    ctrl_[index] = Fragment(hash);
+    ++size_;
+    return {&slots_[index].value, true};
+}
+template <typename K, typename V>
+V& PointerMap<K, V>::operator[](const K& key) {
+    return *Insert(key, V()).first;
+}
+template <typename K, typename V>
+void PointerMap<K, V>::EraseAt(size_t index) {
+    slots_[index].~Slot();
+    --size_;
+    // Probes stop at the first group with an empty slot, so if this group already has one, no
+    // probe can need to pass through this slot and it may become empty again
+    size_t base = index / kPointerMapGroupSize * kPointerMapGroupSize;
+    if (PointerMapGroup(ctrl_ + base).MatchEmpty()) {
+        ctrl_[index] = kPointerMapEmpty;
+        ++growth_left_;
+    } else {
+        ctrl_[index] = kPointerMapDeleted;
+    }
+}
+template <typename K, typename V>
+template <typename Q>
+bool PointerMap<K, V>::Erase(const Q& key) {
+    const void* owner = OwnerAddress(key);
+    size_t index = FindIndex(owner, PointerHash(owner));
+    if (index == capacity_) {
+        return false;
+    }
+    EraseAt(index);
+    return true;
+}
+template <typename K, typename V>
+template <typename Predicate>
+size_t PointerMap<K, V>::EraseIf(Predicate&& predicate) {
+    size_t erased = 0;
+    for (size_t i = 0; i < capacity_; ++i) {
+        if (ctrl_[i] >= 0 && predicate(slots_[i].key, slots_[i].value)) {
+            EraseAt(i);
+            ++erased;
+        }
+    }
+    return erased;
+}
+template <typename K, typename V>
+template <typename Function>
+void PointerMap<K, V>::ForEach(Function&& function) {
+    for (size_t i = 0; i < capacity_; ++i) {
+        if (ctrl_[i] >= 0) {
+            function(static_cast<const K&>(slots_[i].key), slots_[i].value);
+        }
+    }
+}
+template <typename K, typename V>
+void PointerMap<K, V>::Reserve(size_t size) {
+    size_t capacity = capacity_ ? capacity_ : kPointerMapGroupSize;
+    while (MaxLoad(capacity) < size) {
+        capacity *= 2;
+    }
+    if (capacity != capacity_) {
+        Resize(capacity);
+    }
+}
+template <typename K, typename V>
+void PointerMap<K, V>::Resize(size_t capacity) {
+    auto slots = static_cast<Slot*>(
+        ::operator new(capacity * sizeof(Slot), std::align_val_t(alignof(Slot))));
+    int8_t* old_ctrl = std::exchange(ctrl_, new (std::nothrow) int8_t[capacity]);
+    if (!ctrl_) {
+        ctrl_ = old_ctrl;
+        ::operator delete(slots, std::align_val_t(alignof(Slot)));
+        throw std::bad_alloc();
+    }
+    std::memset(ctrl_, kPointerMapEmpty, capacity);
+    Slot* old_slots = std::exchange(slots_, slots);
+    size_t old_capacity = std::exchange(capacity_, capacity);
+    growth_left_ = MaxLoad(capacity) - size_;
+    for (size_t i = 0; i < old_capacity; ++i) {
+        if (old_ctrl[i] >= 0) {
+            uint64_t hash = PointerHash(OwnerAddress(old_slots[i].key));
+            size_t index = FindFree(hash);
+            new (&slots_[index]) Slot{std::move(old_slots[i])};
+            ctrl_[index] = Fragment(hash);
+            old_slots[i].~Slot();
+        }
+    }
+    delete[] old_ctrl;
+    ::operator delete(old_slots, std::align_val_t(alignof(Slot)));
+}
+template <typename K, typename V>
+void PointerMap<K, V>::Clear() {
+    for (size_t i = 0; i < capacity_; ++i) {
+        if (ctrl_[i] >= 0) {
+            slots_[i].~Slot();
+            ctrl_[i] = kPointerMapEmpty;
+        }
+    }
+    size_ = 0;
+    growth_left_ = MaxLoad(capacity_);
+}
+template <typename K, typename V>
+void PointerMap<K, V>::Destroy() {
+    Clear();
+    delete[] ctrl_;
+    ::operator delete(slots_, std::align_val_t(alignof(Slot)));
+    ctrl_ = nullptr;
+    slots_ = nullptr;
+    capacity_ = 0;
+    growth_left_ = 0;
+}
+template <typename K, typename V>
+size_t PointerMap<K, V>::Size() const {
+    return size_;
+}
+template <typename K, typename V>
+bool PointerMap<K, V>::Empty() const {
+    return size_ == 0;
+}
+template <typename K, typename V>
+size_t PointerMap<K, V>::Capacity() const {
+    return capacity_;
+}
@@ -0,0 +1,351 @@
+#pragma once
+
+#include "../intrusive/intrusive.h"
+#include "../shared-from-this/shared.h"
+#include "../shared-from-this/weak.h"
+#include "../sharded/percpu.h"
+
+#include <atomic>
+#include <cstddef>  // offsetof
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+// Free lists shared by a pool and the nodes it handed out. Nodes are parked in per-thread
+// shards (the same thread numbering as `PercpuCount`), each behind its own lock on its own
+// cache line. The core outlives the pool while any node is still out: it holds one reference
+// for the pool and one per existing node, and whoever drops the last one deletes it.
+template <typename T, typename Node>
+class PoolCore {
+public:
+    using ResetHook = void (*)(T& object);
+
+    PoolCore(size_t capacity, ResetHook reset);
+    PoolCore(const PoolCore& other) = delete;
+    PoolCore& operator=(const PoolCore& other) = delete;
+
+    // An idle node, or `nullptr` if there is none
+    Node* TryAcquire();
+    // Accounts for a node the pool has just created
+    void Retain();
+    // Parks a node whose object is no longer referenced, or frees it if the pool is full/closed
+    void Release(Node* node);
+    void RunReset(T& object) const;
+
+    size_t Trim(size_t keep);
+    size_t IdleCount() const;
+    size_t TakeAcquiredCount();
+    // Called by the pool's destructor
+    void Close();
+
+private:
+    struct alignas(kCacheLineSize) Shard {
+        std::mutex mutex;
+        std::vector<Node*> nodes;
+    };
+
+    Shard& ThreadShard();
+    void Free(Node* node);
+    void Unref();
+
+    std::vector<Shard> shards_;
+    size_t capacity_;
+    ResetHook reset_;
+    std::atomic<size_t> idle_;
+    std::atomic<size_t> acquired_;
+    std::atomic<size_t> refs_;
+    std::atomic<bool> closed_;
+};
+template <typename T, typename Node>
+PoolCore<T, Node>::PoolCore(size_t capacity, ResetHook reset)
+    : shards_(PercpuDefaultSlots()),
+      capacity_(capacity),
+      reset_(reset),
+      idle_(0),
+      acquired_(0),
+      refs_(1),
+      closed_(false) {
+}
+template <typename T, typename Node>
+typename PoolCore<T, Node>::Shard& PoolCore<T, Node>::ThreadShard() {
+    return shards_[PercpuThreadIndex() % shards_.size()];
+}
+template <typename T, typename Node>
+Node* PoolCore<T, Node>::TryAcquire() {
+    acquired_.fetch_add(1, std::memory_order_relaxed);
+    if (idle_.load(std::memory_order_relaxed) == 0) {
+        return nullptr;
+    }
+    size_t own = PercpuThreadIndex() % shards_.size();
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        Shard& shard = shards_[(own + i) % shards_.size()];
+        // Other threads' shards are only raided when uncontended
+        std::unique_lock lock(shard.mutex, std::defer_lock);
+        if (i == 0) {
+            lock.lock();
+        } else if (!lock.try_lock()) {
+            continue;
+        }
+        if (!shard.nodes.empty()) {
+            Node* node = shard.nodes.back();
+            shard.nodes.pop_back();
+            idle_.fetch_sub(1, std::memory_order_relaxed);
+            return node;
+        }
+    }
+    return nullptr;
+}
+template <typename T, typename Node>
+void PoolCore<T, Node>::Retain() {
+    refs_.fetch_add(1, std::memory_order_relaxed);
+}
+template <typename T, typename Node>
+void PoolCore<T, Node>::Release(Node* node) {
+    Shard& shard = ThreadShard();
+    {
+        std::lock_guard guard(shard.mutex);
+        if (!closed_.load(std::memory_order_acquire) &&
+            idle_.load(std::memory_order_relaxed) < capacity_) {
+            shard.nodes.push_back(node);
+            idle_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+    Free(node);
+}
+template <typename T, typename Node>
+void PoolCore<T, Node>::RunReset(T& object) const {
+    if (reset_) {
+        reset_(object);
+    }
+}
+template <typename T, typename Node>
+size_t PoolCore<T, Node>::Trim(size_t keep) {
+    std::vector<Node*> to_free;
+    for (auto& shard : shards_) {
+        std::lock_guard guard(shard.mutex);
+        while (!shard.nodes.empty() && idle_.load(std::memory_order_relaxed) > keep) {
+            to_free.push_back(shard.nodes.back());
+            shard.nodes.pop_back();
+            idle_.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+    for (Node* node : to_free) {
+        Free(node);
+    }
+    return to_free.size();
+}
+template <typename T, typename Node>
+size_t PoolCore<T, Node>::IdleCount() const {
+    return idle_.load(std::memory_order_relaxed);
+}
+template <typename T, typename Node>
+size_t PoolCore<T, Node>::TakeAcquiredCount() {
+    return acquired_.exchange(0, std::memory_order_relaxed);
+}
+template <typename T, typename Node>
+void PoolCore<T, Node>::Close() {
+    closed_.store(true, std::memory_order_release);
+    Trim(0);
+    Unref();
+}
+template <typename T, typename Node>
+void PoolCore<T, Node>::Free(Node* node) {
+    delete node;
+    Unref();
+}
+template <typename T, typename Node>
+void PoolCore<T, Node>::Unref() {
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete this;
+    }
+}
+
+////////////////////////////////////////////////////////////
+
+// Control block whose payload survives the last strong reference: `DeleteSource` only runs the
+// pool's reset hook, and once the weak count drops too the whole block goes back to the pool.
+template <typename T>
+class ControlBlockPooled : public ControlBlockBase {
+public:
+    using Core = PoolCore<T, ControlBlockPooled<T>>;
+
+    explicit ControlBlockPooled(Core* core);
+    ~ControlBlockPooled() override;
+
+    T* GetPtr();
+    void Revive();
+    void DeleteSource() override;
+    const void* Source() const override;
+    const std::type_info* SourceType() const override;
+
+protected:
+    void DeleteBlock() override;
+
+private:
+    Core* core_;
+    std::aligned_storage_t<sizeof(T), alignof(T)> storage_;
+};
+template <typename T>
+ControlBlockPooled<T>::ControlBlockPooled(Core* core) : ControlBlockBase(), core_(core) {
+    new (&storage_) T{};
+}
+template <typename T>
+ControlBlockPooled<T>::~ControlBlockPooled() {
+    GetPtr()->~T();
+}
+template <typename T>
+T* ControlBlockPooled<T>::GetPtr() {
+    return reinterpret_cast<T*>(&storage_);
+}
+template <typename T>
+void ControlBlockPooled<T>::Revive() {
+    ResetCounts();
+}
+template <typename T>
+void ControlBlockPooled<T>::DeleteSource() {
+    if constexpr (std::is_base_of_v<EnableSharedFromThisBase, T>) {
+        // Otherwise `weak_this_` would keep the block from ever reaching a zero weak count
+        GetPtr()->weak_this_.Reset();
+    }
+    core_->RunReset(*GetPtr());
+}
+template <typename T>
+const void* ControlBlockPooled<T>::Source() const {
+    return &storage_;
+}
+template <typename T>
+const std::type_info* ControlBlockPooled<T>::SourceType() const {
+    return &typeid(T);
+}
+template <typename T>
+void ControlBlockPooled<T>::DeleteBlock() {
+    core_->Release(this);
+}
+
+// `Deleter` policy for `RefCounted` objects handed out by an `ObjectPool`
+struct PoolDelete {
+    template <typename T>
+    static void Destroy(T* object);
+};
+
+// Allocation unit for pooled `RefCounted` objects: the core pointer sits right before the
+// object, so `PoolDelete` can find its way back to the pool from the object alone.
+template <typename T>
+struct IntrusivePoolNode {
+    using Core = PoolCore<T, IntrusivePoolNode<T>>;
+
+    explicit IntrusivePoolNode(Core* core) : core(core) {
+        new (&storage) T{};
+    }
+    ~IntrusivePoolNode() {
+        GetPtr()->~T();
+    }
+    T* GetPtr() {
+        return reinterpret_cast<T*>(&storage);
+    }
+
+    Core* core;
+    std::aligned_storage_t<sizeof(T), alignof(T)> storage;
+};
+
+template <typename T>
+void PoolDelete::Destroy(T* object) {
+    auto node = reinterpret_cast<IntrusivePoolNode<T>*>(reinterpret_cast<char*>(object) -
+                                                        offsetof(IntrusivePoolNode<T>, storage));
+    node->core->RunReset(*object);
+    node->core->Release(node);
+}
+
+template <typename Derived, typename Counter = SimpleCounter>
+using PooledRefCounted = RefCounted<Derived, Counter, PoolDelete>;
+
+template <typename Derived, typename Counter>
+std::true_type IsPooledRefCountedProbe(const RefCounted<Derived, Counter, PoolDelete>*);
+std::false_type IsPooledRefCountedProbe(...);
+
+template <typename T>
+constexpr bool kIsPooledRefCounted =
+    decltype(IsPooledRefCountedProbe(static_cast<const T*>(nullptr)))::value;
+
+////////////////////////////////////////////////////////////
+
+// Recycles objects instead of destroying them. Hands out `SharedPtr<T>`, or `IntrusivePtr<T>`
+// when `T` derives from `PooledRefCounted<T>`. When the last reference goes away the object is
+// passed to the reset hook and, together with its control block, parked on the releasing
+// thread's free list; the next `Acquire` reuses it without touching the allocator. At most
+// `capacity` idle objects are kept, the rest are destroyed as usual.
+//
+// `T` must be default constructible: new objects are value-initialized, recycled ones come back
+// in whatever state the reset hook left them.
+template <typename T>
+class ObjectPool {
+public:
+    using Node = std::conditional_t<kIsPooledRefCounted<T>, IntrusivePoolNode<T>,
+                                    ControlBlockPooled<T>>;
+    using Pointer = std::conditional_t<kIsPooledRefCounted<T>, IntrusivePtr<T>, SharedPtr<T>>;
+    using ResetHook = typename PoolCore<T, Node>::ResetHook;
+
+    explicit ObjectPool(size_t capacity, ResetHook reset = nullptr);
+    ObjectPool(const ObjectPool& other) = delete;
+    ObjectPool& operator=(const ObjectPool& other) = delete;
+    // Objects still referenced outlive the pool and are destroyed normally on release
+    ~ObjectPool();
+
+    Pointer Acquire();
+
+    // Destroys idle objects until at most `keep` remain; returns how many were destroyed
+    size_t Trim(size_t keep = 0);
+    // Meant to be called periodically: if nothing was acquired since the previous call, the pool
+    // is considered idle and gives back half of its idle objects
+    size_t TrimIfIdle();
+    size_t IdleCount() const;
+
+private:
+    PoolCore<T, Node>* core_;
+};
+template <typename T>
+ObjectPool<T>::ObjectPool(size_t capacity, ResetHook reset)
+    : core_(new PoolCore<T, Node>(capacity, reset)) {
+}
+template <typename T>
+ObjectPool<T>::~ObjectPool() {
+    core_->Close();
+}
+template <typename T>
+typename ObjectPool<T>::Pointer ObjectPool<T>::Acquire() {
+    Node* node = core_->TryAcquire();
+    if (!node) {
+        node = new Node(core_);
+        core_->Retain();
+    } else if constexpr (!kIsPooledRefCounted<T>) {
+        node->Revive();
+    }
+    if constexpr (kIsPooledRefCounted<T>) {
+        return IntrusivePtr<T>(node->GetPtr());
+    } else {
+        SharedPtr<T> result(node->GetPtr(), node);
+        if constexpr (std::is_base_of_v<EnableSharedFromThisBase, T>) {
+            node->GetPtr()->weak_this_ = result;
+        }
+        return result;
+    }
+}
+template <typename T>
+size_t ObjectPool<T>::Trim(size_t keep) {
+    return core_->Trim(keep);
+}
+template <typename T>
+size_t ObjectPool<T>::TrimIfIdle() {
+    if (core_->TakeAcquiredCount() != 0) {
+        return 0;
+    }
+    return core_->Trim(core_->IdleCount() / 2);
+}
+template <typename T>
+size_t ObjectPool<T>::IdleCount() const {
+    return core_->IdleCount();
+}
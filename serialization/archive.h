@@ -0,0 +1,484 @@
+#pragma once
+
+#include "../shared-from-this/shared.h"
+#include "../shared-from-this/weak.h"
+#include "../unique/unique.h"
+
+#include <algorithm>  // std::min, std::max
+#include <cstdint>
+#include <cstring>    // std::memcpy
+#include <deque>
+#include <exception>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Binary archives for object graphs built from `SharedPtr`, `WeakPtr` and `UniquePtr`.
+//
+// A user type opts in with
+//     template <typename Archive>
+//     void Serialize(Archive& ar) { ar(field_a, field_b); }
+// which is used both for saving and for loading; loaded types must be default constructible.
+//
+// Every control block is written once. The first pointer met for a block carries the payload,
+// later ones (including pointers made by the aliasing constructor) are written as the block id
+// plus a byte offset from that first pointer, and `WeakPtr`s as back-references to the block.
+// Payloads are written breadth-first from a queue instead of recursively, so long chains of
+// nodes do not exhaust the stack.
+//
+// Pointers are serialized by their static type, so the first pointer met for a block must point
+// at the object the block owns, with the type the block created it as: an aliasing pointer to a
+// member, a base-class pointer to a derived object (polymorphic or not) or an abstract pointee
+// throws `ArchiveError` there. Later pointers to the same block may be of any of these kinds.
+//
+// Loading trusts no length in the input: containers grow with the bytes actually read, so a
+// corrupt or truncated archive ends in `ArchiveError` rather than a huge allocation.
+
+class ArchiveError : public std::exception {
+public:
+    explicit ArchiveError(const char* what) : what_(what) {
+    }
+    const char* what() const noexcept override {
+        return what_;
+    }
+
+private:
+    const char* what_;
+};
+
+inline constexpr size_t kArchiveBufferSize = 1 << 16;
+
+// Vectors of these are written as one block of bytes; `std::vector<bool>` has no such block
+template <typename T>
+inline constexpr bool kArchiveBulk =
+    (std::is_arithmetic_v<T> || std::is_enum_v<T>) && !std::is_same_v<T, bool>;
+
+class OutputArchive {
+public:
+    explicit OutputArchive(std::ostream& out);
+    OutputArchive(const OutputArchive& other) = delete;
+    OutputArchive& operator=(const OutputArchive& other) = delete;
+    ~OutputArchive();
+
+    template <typename... Ts>
+    void operator()(const Ts&... values);
+
+    void Flush();
+
+private:
+    struct Pending {
+        SharedPtr<char> keep_alive;
+        void (*save)(OutputArchive& ar, const char* object);
+    };
+    struct Written {
+        uint64_t id;
+        const char* address;
+        // Ids are keyed by block address, so the block must outlive the archive: a freed one
+        // could come back as a new object's block and be taken for the old one
+        WeakPtr<char> block;
+    };
+
+    template <typename T>
+    void Save(const T& value);
+    template <typename T>
+    void Save(const std::vector<T>& values);
+    void Save(const std::string& value);
+    template <typename T>
+    void Save(const SharedPtr<T>& ptr);
+    template <typename T>
+    void Save(const WeakPtr<T>& ptr);
+    template <typename T, typename Deleter>
+    void Save(const UniquePtr<T, Deleter>& ptr);
+
+    template <typename T>
+    void SaveReference(const SharedPtr<T>& ptr, ControlBlockBase* block);
+    template <typename T>
+    static void SavePayload(OutputArchive& ar, const char* object);
+    void Drain();
+
+    void WriteBytes(const void* data, size_t size);
+    void WriteVarint(uint64_t value);
+
+    std::ostream& out_;
+    std::vector<char> buffer_;
+    size_t used_;
+    std::unordered_map<const ControlBlockBase*, Written> ids_;
+    std::deque<Pending> pending_;
+    bool draining_;
+};
+inline OutputArchive::OutputArchive(std::ostream& out)
+    : out_(out), buffer_(kArchiveBufferSize), used_(0), draining_(false) {
+}
+inline OutputArchive::~OutputArchive() {
+    Flush();
+}
+template <typename... Ts>
+void OutputArchive::operator()(const Ts&... values) {
+    (Save(values), ...);
+    Drain();
+}
+inline void OutputArchive::Flush() {
+    if (used_) {
+        out_.write(buffer_.data(), used_);
+        used_ = 0;
+    }
+    out_.flush();
+}
+template <typename T>
+void OutputArchive::Save(const T& value) {
+    if constexpr (std::is_arithmetic_v<T> || std::is_enum_v<T>) {
+        WriteBytes(&value, sizeof(T));
+    } else {
+        const_cast<T&>(value).Serialize(*this);
+    }
+}
+template <typename T>
+void OutputArchive::Save(const std::vector<T>& values) {
+    WriteVarint(values.size());
+    if constexpr (kArchiveBulk<T>) {
+        WriteBytes(values.data(), values.size() * sizeof(T));
+    } else {
+        for (const auto& value : values) {
+            Save(value);
+        }
+    }
+}
+inline void OutputArchive::Save(const std::string& value) {
+    WriteVarint(value.size());
+    WriteBytes(value.data(), value.size());
+}
+template <typename T>
+void OutputArchive::Save(const SharedPtr<T>& ptr) {
+    SaveReference(ptr, ptr.control_);
+}
+template <typename T>
+void OutputArchive::Save(const WeakPtr<T>& ptr) {
+    if (!ptr.control_ || !ptr.control_->IsResourceAlive()) {
+        WriteVarint(0);
+        return;
+    }
+    // Keeps a weakly reachable object alive until its payload is written
+    SaveReference(ptr.Lock(), ptr.control_);
+}
+template <typename T, typename Deleter>
+void OutputArchive::Save(const UniquePtr<T, Deleter>& ptr) {
+    bool present = static_cast<bool>(ptr);
+    Save(present);
+    if (present) {
+        Save(*ptr);
+    }
+}
+template <typename T>
+void OutputArchive::SaveReference(const SharedPtr<T>& ptr, ControlBlockBase* block) {
+    if (!block) {
+        WriteVarint(0);
+        return;
+    }
+    using Object = std::remove_cv_t<T>;
+    const char* address = reinterpret_cast<const char*>(ptr.Get());
+    auto it = ids_.find(block);
+    if (it == ids_.end()) {
+        // The payload is saved as an `Object` and loaded into a fresh `MakeShared<Object>`
+        if constexpr (std::is_abstract_v<Object>) {
+            throw ArchiveError("first pointer to an object has an abstract type");
+        } else {
+            if (block->Source() != address) {
+                throw ArchiveError("first pointer to an object does not point at the object");
+            }
+            // The block's type catches `SharedPtr<Base>(new Derived)`; the dynamic type also
+            // catches a derived object adopted through a base pointer
+            const std::type_info* type = block->SourceType();
+            if (!type || *type != typeid(Object)) {
+                throw ArchiveError("first pointer to an object has a base class type");
+            }
+            if constexpr (std::is_polymorphic_v<Object>) {
+                if (typeid(*ptr.Get()) != typeid(Object)) {
+                    throw ArchiveError("first pointer to an object has a base class type");
+                }
+            }
+            SharedPtr<char> object(ptr, const_cast<char*>(address));
+            it = ids_.try_emplace(block, Written{ids_.size(), address, WeakPtr<char>(object)})
+                     .first;
+            pending_.push_back(Pending{std::move(object), &SavePayload<Object>});
+        }
+    }
+    WriteVarint(it->second.id + 1);
+    int64_t offset = address - it->second.address;
+    WriteVarint((static_cast<uint64_t>(offset) << 1) ^ static_cast<uint64_t>(offset >> 63));
+}
+template <typename T>
+void OutputArchive::SavePayload(OutputArchive& ar, const char* object) {
+    ar.Save(*reinterpret_cast<const T*>(object));
+}
+inline void OutputArchive::Drain() {
+    if (draining_) {
+        return;
+    }
+    draining_ = true;
+    while (!pending_.empty()) {
+        Pending next = std::move(pending_.front());
+        pending_.pop_front();
+        next.save(*this, next.keep_alive.Get());
+    }
+    draining_ = false;
+}
+inline void OutputArchive::WriteBytes(const void* data, size_t size) {
+    auto bytes = static_cast<const char*>(data);
+    if (size >= buffer_.size()) {
+        Flush();
+        out_.write(bytes, size);
+        return;
+    }
+    if (used_ + size > buffer_.size()) {
+        out_.write(buffer_.data(), used_);
+        used_ = 0;
+    }
+    std::memcpy(buffer_.data() + used_, bytes, size);
+    used_ += size;
+}
+inline void OutputArchive::WriteVarint(uint64_t value) {
+    char bytes[10];
+    size_t size = 0;
+    while (value >= 0x80) {
+        bytes[size++] = static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    bytes[size++] = static_cast<char>(value);
+    WriteBytes(bytes, size);
+}
+
+////////////////////////////////////////////////////////////
+
+class InputArchive {
+public:
+    explicit InputArchive(std::istream& in);
+    InputArchive(const InputArchive& other) = delete;
+    InputArchive& operator=(const InputArchive& other) = delete;
+
+    template <typename... Ts>
+    void operator()(Ts&... values);
+
+    // Objects are retained by the archive so that back-references can be resolved; this drops
+    // them, after which objects reachable only through `WeakPtr`s expire as in the saved graph.
+    void Finish();
+
+private:
+    struct Pending {
+        char* object;
+        void (*load)(InputArchive& ar, char* object);
+    };
+
+    template <typename T>
+    void Load(T& value);
+    template <typename T>
+    void Load(std::vector<T>& values);
+    void Load(std::string& value);
+    template <typename T>
+    void Load(SharedPtr<T>& ptr);
+    template <typename T>
+    void Load(WeakPtr<T>& ptr);
+    template <typename T, typename Deleter>
+    void Load(UniquePtr<T, Deleter>& ptr);
+
+    template <typename T>
+    SharedPtr<T> LoadReference();
+    template <typename T>
+    static void LoadPayload(InputArchive& ar, char* object);
+    void Drain();
+
+    void ReadBytes(void* data, size_t size);
+    uint64_t ReadVarint();
+    // A length prefix, checked against what `max_size` can hold
+    size_t ReadLength(size_t max_size);
+    void Refill();
+
+    std::istream& in_;
+    std::vector<char> buffer_;
+    size_t begin_;
+    size_t end_;
+    struct Loaded {
+        SharedPtr<char> object;
+        size_t size;
+    };
+
+    std::vector<Loaded> objects_;
+    std::deque<Pending> pending_;
+    bool draining_;
+};
+inline InputArchive::InputArchive(std::istream& in)
+    : in_(in), buffer_(kArchiveBufferSize), begin_(0), end_(0), draining_(false) {
+}
+template <typename... Ts>
+void InputArchive::operator()(Ts&... values) {
+    (Load(values), ...);
+    Drain();
+}
+inline void InputArchive::Finish() {
+    objects_.clear();
+    objects_.shrink_to_fit();
+}
+template <typename T>
+void InputArchive::Load(T& value) {
+    if constexpr (std::is_same_v<T, bool>) {
+        // Any other byte would make a `bool` with an invalid value representation
+        unsigned char byte;
+        ReadBytes(&byte, 1);
+        if (byte > 1) {
+            throw ArchiveError("malformed bool");
+        }
+        value = byte != 0;
+    } else if constexpr (std::is_arithmetic_v<T> || std::is_enum_v<T>) {
+        ReadBytes(&value, sizeof(T));
+    } else {
+        value.Serialize(*this);
+    }
+}
+template <typename T>
+void InputArchive::Load(std::vector<T>& values) {
+    size_t size = ReadLength(values.max_size());
+    values.clear();
+    if constexpr (kArchiveBulk<T>) {
+        // A buffer at a time, so the vector never gets much ahead of the input
+        size_t chunk = std::max<size_t>(kArchiveBufferSize / sizeof(T), 1);
+        while (values.size() < size) {
+            size_t done = values.size();
+            values.resize(done + std::min(chunk, size - done));
+            ReadBytes(values.data() + done, (values.size() - done) * sizeof(T));
+        }
+    } else if constexpr (std::is_same_v<T, bool>) {
+        // Elements of `std::vector<bool>` are bits behind proxy references
+        for (size_t i = 0; i < size; ++i) {
+            bool value;
+            Load(value);
+            values.push_back(value);
+        }
+    } else {
+        for (size_t i = 0; i < size; ++i) {
+            values.emplace_back();
+            Load(values.back());
+        }
+    }
+}
+inline void InputArchive::Load(std::string& value) {
+    size_t size = ReadLength(value.max_size());
+    value.clear();
+    while (value.size() < size) {
+        size_t done = value.size();
+        value.resize(done + std::min(kArchiveBufferSize, size - done));
+        ReadBytes(value.data() + done, value.size() - done);
+    }
+}
+template <typename T>
+void InputArchive::Load(SharedPtr<T>& ptr) {
+    ptr = LoadReference<T>();
+}
+template <typename T>
+void InputArchive::Load(WeakPtr<T>& ptr) {
+    ptr = WeakPtr<T>(LoadReference<T>());
+}
+template <typename T, typename Deleter>
+void InputArchive::Load(UniquePtr<T, Deleter>& ptr) {
+    bool present;
+    Load(present);
+    if (!present) {
+        ptr = nullptr;
+        return;
+    }
+    ptr.Reset(new T());
+    Load(*ptr);
+}
+template <typename T>
+SharedPtr<T> InputArchive::LoadReference() {
+    using Object = std::remove_cv_t<T>;
+    uint64_t id = ReadVarint();
+    if (id == 0) {
+        return SharedPtr<T>();
+    }
+    --id;
+    uint64_t zigzag = ReadVarint();
+    int64_t offset = static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+    if (id == objects_.size()) {
+        if constexpr (std::is_abstract_v<Object>) {
+            throw ArchiveError("archive creates an object of an abstract type");
+        } else {
+            // MakeShared fuses the block with the payload; fields are filled in when the payload
+            // record comes up in the queue
+            SharedPtr<Object> created = MakeShared<Object>();
+            auto object = reinterpret_cast<char*>(created.Get());
+            objects_.push_back({SharedPtr<char>(created, object), sizeof(Object)});
+            pending_.push_back(Pending{object, &LoadPayload<Object>});
+        }
+    } else if (id > objects_.size()) {
+        throw ArchiveError("archive refers to an object that was not written yet");
+    }
+    // Later pointers may only point inside the object, e.g. at a member or a base
+    const auto& [base, size] = objects_[id];
+    if (offset < 0 || static_cast<uint64_t>(offset) > size || sizeof(T) > size - offset ||
+        offset % alignof(T) != 0) {
+        throw ArchiveError("archive points outside of an object");
+    }
+    return SharedPtr<T>(base, reinterpret_cast<T*>(base.Get() + offset));
+}
+template <typename T>
+void InputArchive::LoadPayload(InputArchive& ar, char* object) {
+    ar.Load(*reinterpret_cast<T*>(object));
+}
+inline void InputArchive::Drain() {
+    if (draining_) {
+        return;
+    }
+    draining_ = true;
+    while (!pending_.empty()) {
+        Pending next = pending_.front();
+        pending_.pop_front();
+        next.load(*this, next.object);
+    }
+    draining_ = false;
+}
+inline void InputArchive::Refill() {
+    in_.read(buffer_.data(), buffer_.size());
+    begin_ = 0;
+    end_ = in_.gcount();
+    if (end_ == 0) {
+        throw ArchiveError("unexpected end of archive");
+    }
+}
+inline void InputArchive::ReadBytes(void* data, size_t size) {
+    auto bytes = static_cast<char*>(data);
+    while (size > 0) {
+        if (begin_ == end_) {
+            Refill();
+        }
+        size_t chunk = std::min(size, end_ - begin_);
+        std::memcpy(bytes, buffer_.data() + begin_, chunk);
+        begin_ += chunk;
+        bytes += chunk;
+        size -= chunk;
+    }
+}
+inline uint64_t InputArchive::ReadVarint() {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (begin_ == end_) {
+            Refill();
+        }
+        auto byte = static_cast<unsigned char>(buffer_[begin_++]);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+    throw ArchiveError("malformed varint");
+}
+inline size_t InputArchive::ReadLength(size_t max_size) {
+    uint64_t length = ReadVarint();
+    if (length > max_size) {
+        throw ArchiveError("length past what a container can hold");
+    }
+    return static_cast<size_t>(length);
+}
@@ -0,0 +1,140 @@
+// Regression checks of the archives: block ids surviving the objects they were given to, sliced
+// first pointers, and corrupt input. Not part of any build; exits non-zero on the first failed
+// check. `unique.h` wants the directory holding `common/my_int.h` on the include path:
+//     g++ -std=c++17 -O1 -g -I<include dir> serialization/test.cpp -o serialization-test
+
+#include "archive.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define CHECK(condition)                                                                    \
+    do {                                                                                    \
+        if (!(condition)) {                                                                 \
+            std::fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #condition);   \
+            std::exit(1);                                                                   \
+        }                                                                                   \
+    } while (false)
+
+namespace {
+
+struct Node {
+    int value = 0;
+
+    template <typename Archive>
+    void Serialize(Archive& ar) {
+        ar(value);
+    }
+};
+
+struct Base {
+    int base = 0;
+
+    template <typename Archive>
+    void Serialize(Archive& ar) {
+        ar(base);
+    }
+};
+
+struct Derived : Base {
+    int derived = 0;
+};
+
+template <typename F>
+bool ThrowsArchiveError(F f) {
+    try {
+        f();
+    } catch (const ArchiveError&) {
+        return true;
+    }
+    return false;
+}
+
+// An object saved and freed before the next save must not lend its id to a new object that
+// gets the same block address
+void TestFreedBlockIsNotReused() {
+    std::stringstream stream;
+    {
+        OutputArchive out(stream);
+        SharedPtr<Node> first = MakeShared<Node>(Node{1});
+        out(first);
+        first.Reset();
+        for (int i = 2; i < 10; ++i) {
+            out(MakeShared<Node>(Node{i}));
+        }
+    }
+    InputArchive in(stream);
+    std::vector<SharedPtr<Node>> loaded(9);
+    for (auto& node : loaded) {
+        in(node);
+    }
+    for (size_t i = 0; i < loaded.size(); ++i) {
+        CHECK(loaded[i]->value == static_cast<int>(i) + 1);
+        CHECK(i == 0 || loaded[i].Get() != loaded[i - 1].Get());
+    }
+}
+
+// A base pointer owning a derived object would be saved and loaded as a sliced `Base`
+void TestSlicedFirstPointerThrows() {
+    std::stringstream stream;
+    OutputArchive out(stream);
+    CHECK(ThrowsArchiveError([&] { out(SharedPtr<Base>(new Derived)); }));
+    CHECK(ThrowsArchiveError([&] { out(SharedPtr<Base>(MakeShared<Derived>())); }));
+    out(MakeShared<Base>());
+}
+
+void TestRoundTrip() {
+    std::vector<bool> bits = {true, false, true, true};
+    std::vector<int> numbers(100000);
+    for (size_t i = 0; i < numbers.size(); ++i) {
+        numbers[i] = static_cast<int>(i * 7);
+    }
+    std::string text(200000, 'x');
+    std::stringstream stream;
+    {
+        OutputArchive out(stream);
+        out(bits, numbers, text);
+    }
+    std::vector<bool> loaded_bits;
+    std::vector<int> loaded_numbers;
+    std::string loaded_text;
+    InputArchive in(stream);
+    in(loaded_bits, loaded_numbers, loaded_text);
+    CHECK(loaded_bits == bits);
+    CHECK(loaded_numbers == numbers);
+    CHECK(loaded_text == text);
+}
+
+// Lengths near 2^42 followed by three bytes: the archive ends long before such a container would
+template <typename T>
+void CheckCorruptLength() {
+    std::stringstream stream(std::string("\x80\x80\x80\x80\x80\x80\x01" "abc", 10));
+    InputArchive in(stream);
+    T value;
+    CHECK(ThrowsArchiveError([&] { in(value); }));
+}
+
+void TestCorruptInput() {
+    CheckCorruptLength<std::string>();
+    CheckCorruptLength<std::vector<int>>();
+    CheckCorruptLength<std::vector<Node>>();
+    CheckCorruptLength<std::vector<bool>>();
+
+    std::stringstream bad_bool(std::string("\x02", 1));
+    InputArchive in(bad_bool);
+    bool flag;
+    CHECK(ThrowsArchiveError([&] { in(flag); }));
+}
+
+}  // namespace
+
+int main() {
+    TestFreedBlockIsNotReused();
+    TestSlicedFirstPointerThrows();
+    TestRoundTrip();
+    TestCorruptInput();
+    std::printf("ok\n");
+}
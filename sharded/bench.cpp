@@ -0,0 +1,69 @@
+// Threads copying and dropping pointers to one hot object: `ShardedSharedPtr` against a
+// `SharedPtr`, whose single counter line every copy writes. Not part of any build:
+//     g++ -std=c++17 -O2 -pthread sharded/bench.cpp -o sharded-bench && ./sharded-bench [threads]
+// The default is 64 threads; the numbers only mean something with that many cores.
+
+#include "shared.h"
+#include "../shared-from-this/shared.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr int kCopiesPerThread = 1000000;
+
+struct Logger {
+    int level;
+};
+
+// Each thread copies its own handle, reads through the copy and drops it
+template <typename Ptr>
+double NanosecondsPerCopy(const Ptr& source, int threads) {
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+    std::atomic<long> sink{0};
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i) {
+        workers.emplace_back([&, local = source] {
+            ready.fetch_add(1);
+            while (!go.load(std::memory_order_acquire)) {
+            }
+            long sum = 0;
+            for (int k = 0; k < kCopiesPerThread; ++k) {
+                Ptr copy = local;
+                sum += copy->level;
+            }
+            sink.fetch_add(sum, std::memory_order_relaxed);
+        });
+    }
+    while (ready.load() < threads) {
+    }
+    auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    // Wall time per copy of one thread, which is what each request pays
+    return elapsed.count() / kCopiesPerThread;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    int threads = argc > 1 ? std::atoi(argv[1]) : 64;
+
+    SharedPtr<Logger> shared = MakeShared<Logger>(Logger{1});
+    double single = NanosecondsPerCopy(shared, threads);
+
+    ShardedOwner<Logger> owner = MakeShardedShared<Logger>(1);
+    double sharded = NanosecondsPerCopy(owner.Share(), threads);
+
+    std::printf("%d threads: SharedPtr %7.1f ns/copy, ShardedSharedPtr %7.1f ns/copy\n", threads,
+                single, sharded);
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <thread>
+
+inline constexpr size_t kCacheLineSize = 64;
+
+// Index of the calling thread's slot; threads are numbered round-robin on first use, so with
+// at least as many slots as threads every thread owns a cache line of its own.
+inline size_t PercpuThreadIndex() {
+    static std::atomic<size_t> next_index{0};
+    thread_local size_t index = next_index.fetch_add(1, std::memory_order_relaxed);
+    return index;
+}
+
+inline size_t PercpuDefaultSlots() {
+    size_t cpus = std::thread::hardware_concurrency();
+    return cpus ? cpus : 1;
+}
+
+// Reference count split over cache-line-padded per-thread slots, in the spirit of Linux
+// `percpu_ref`. While live, `Increase`/`Decrease` only touch the caller's slot; slots may go
+// negative when a reference is taken on one thread and dropped on another, only their sum is
+// meaningful. `Kill` folds every slot into one central atomic exactly and from then on all
+// operations go there, so the count can finally be observed reaching zero.
+//
+// Each slot is switched off by exchanging a sentinel into it, and slot updates are CAS loops
+// that fall back to the central count once they see the sentinel. That way an update racing
+// with `Kill` either lands before the fold (and is folded) or after it (and goes central).
+class PercpuCount {
+public:
+    // Starts live with a count of one, held by whoever created it
+    explicit PercpuCount(size_t slots = PercpuDefaultSlots());
+    PercpuCount(const PercpuCount& other) = delete;
+    PercpuCount& operator=(const PercpuCount& other) = delete;
+    ~PercpuCount();
+
+    void Increase();
+    // Returns `true` if this dropped the last reference, which is only possible after `Kill`
+    bool Decrease();
+    // Switches to central mode. Returns `true` if the count is already zero.
+    bool Kill();
+
+    bool IsKilled() const;
+    // Exact after `Kill`, a racy snapshot before it
+    int64_t Get() const;
+
+private:
+    struct alignas(kCacheLineSize) Slot {
+        std::atomic<int64_t> value{0};
+    };
+
+    static constexpr int64_t kDead = std::numeric_limits<int64_t>::min();
+    // Keeps the central count positive while slots are being folded in one by one
+    static constexpr int64_t kBias = int64_t{1} << 62;
+
+    bool Add(int64_t delta);
+    Slot& ThreadSlot();
+
+    Slot* slots_;
+    size_t slot_count_;
+    alignas(kCacheLineSize) std::atomic<int64_t> central_;
+    std::atomic<bool> killed_;
+};
+inline PercpuCount::PercpuCount(size_t slots)
+    : slots_(new Slot[slots]), slot_count_(slots), central_(1), killed_(false) {
+}
+inline PercpuCount::~PercpuCount() {
+    delete[] slots_;
+}
+inline PercpuCount::Slot& PercpuCount::ThreadSlot() {
+    return slots_[PercpuThreadIndex() % slot_count_];
+}
+inline bool PercpuCount::Add(int64_t delta) {
+    std::atomic<int64_t>& slot = ThreadSlot().value;
+    int64_t value = slot.load(std::memory_order_relaxed);
+    while (value != kDead) {
+        if (slot.compare_exchange_weak(value, value + delta, std::memory_order_acq_rel,
+                                       std::memory_order_relaxed)) {
+            return false;
+        }
+    }
+    return central_.fetch_add(delta, std::memory_order_acq_rel) + delta == 0;
+}
+inline void PercpuCount::Increase() {
+    Add(1);
+}
+inline bool PercpuCount::Decrease() {
+    return Add(-1);
+}
+inline bool PercpuCount::Kill() {
+    if (killed_.exchange(true, std::memory_order_acq_rel)) {
+        return false;
+    }
+    central_.fetch_add(kBias, std::memory_order_relaxed);
+    for (size_t i = 0; i < slot_count_; ++i) {
+        int64_t value = slots_[i].value.exchange(kDead, std::memory_order_acq_rel);
+        central_.fetch_add(value, std::memory_order_relaxed);
+    }
+    return central_.fetch_sub(kBias, std::memory_order_acq_rel) == kBias;
+}
+inline bool PercpuCount::IsKilled() const {
+    return killed_.load(std::memory_order_acquire);
+}
+inline int64_t PercpuCount::Get() const {
+    int64_t sum = central_.load(std::memory_order_acquire);
+    if (IsKilled()) {
+        return sum;
+    }
+    for (size_t i = 0; i < slot_count_; ++i) {
+        int64_t value = slots_[i].value.load(std::memory_order_relaxed);
+        if (value != kDead) {
+            sum += value;
+        }
+    }
+    return sum;
+}
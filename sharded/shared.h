@@ -0,0 +1,294 @@
+#pragma once
+
+#include "percpu.h"
+
+#include <cstddef>  // std::nullptr_t
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Control block for hot, long-lived objects (loggers, registries, schemas) that every thread
+// copies all the time. The strong count is a `PercpuCount`, so a copy or a drop only writes the
+// calling thread's cache line; the object and the block die once the owner has released it and
+// the folded count reaches zero.
+//
+// This is a separate family of pointers, not a `Counts` policy of `SharedPtr`: the control
+// block has no weak count and no type-erased deleter, so a `ShardedSharedPtr` cannot be
+// converted to or from a `SharedPtr`, and there is no weak pointer to it.
+template <typename T>
+class ShardedControlBlock {
+public:
+    template <typename... Args>
+    explicit ShardedControlBlock(Args&&... args);
+
+    T* GetPtr();
+    void IncreaseStrong();
+    void DecreaseStrong();
+    void Kill();
+    int64_t GetCntStrong() const;
+
+private:
+    ~ShardedControlBlock();
+
+    PercpuCount count_;
+    std::aligned_storage_t<sizeof(T), alignof(T)> storage_;
+};
+template <typename T>
+template <typename... Args>
+ShardedControlBlock<T>::ShardedControlBlock(Args&&... args) {
+    new (&storage_) T{std::forward<Args>(args)...};
+}
+template <typename T>
+ShardedControlBlock<T>::~ShardedControlBlock() {
+    GetPtr()->~T();
+}
+template <typename T>
+T* ShardedControlBlock<T>::GetPtr() {
+    return reinterpret_cast<T*>(&storage_);
+}
+template <typename T>
+void ShardedControlBlock<T>::IncreaseStrong() {
+    count_.Increase();
+}
+template <typename T>
+void ShardedControlBlock<T>::DecreaseStrong() {
+    if (count_.Decrease()) {
+        delete this;
+    }
+}
+template <typename T>
+void ShardedControlBlock<T>::Kill() {
+    if (count_.Kill()) {
+        delete this;
+    }
+}
+template <typename T>
+int64_t ShardedControlBlock<T>::GetCntStrong() const {
+    return count_.Get();
+}
+
+template <typename T>
+class ShardedOwner;
+
+// Copyable handle to an object owned by a `ShardedOwner`
+template <typename T>
+class ShardedSharedPtr {
+public:
+    template <typename Y>
+    friend class ShardedOwner;
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    ShardedSharedPtr();
+    ShardedSharedPtr(std::nullptr_t);
+
+    ShardedSharedPtr(const ShardedSharedPtr& other);
+    ShardedSharedPtr(ShardedSharedPtr&& other);
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    ShardedSharedPtr& operator=(const ShardedSharedPtr& other);
+    ShardedSharedPtr& operator=(ShardedSharedPtr&& other);
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~ShardedSharedPtr();
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset();
+    void Swap(ShardedSharedPtr& other);
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T* Get() const;
+    T& operator*() const;
+    T* operator->() const;
+    // Sums all slots; meant for diagnostics, not for hot paths
+    size_t UseCount() const;
+    explicit operator bool() const;
+
+private:
+    explicit ShardedSharedPtr(ShardedControlBlock<T>* block);
+    void Clear();
+
+    ShardedControlBlock<T>* control_;
+    T* ptr_;
+};
+template <typename T>
+ShardedSharedPtr<T>::ShardedSharedPtr() : control_(nullptr), ptr_(nullptr) {
+}
+template <typename T>
+ShardedSharedPtr<T>::ShardedSharedPtr(std::nullptr_t) : control_(nullptr), ptr_(nullptr) {
+}
+template <typename T>
+ShardedSharedPtr<T>::ShardedSharedPtr(ShardedControlBlock<T>* block)
+    : control_(block), ptr_(block->GetPtr()) {
+    control_->IncreaseStrong();
+}
+template <typename T>
+ShardedSharedPtr<T>::ShardedSharedPtr(const ShardedSharedPtr& other)
+    : control_(other.control_), ptr_(other.ptr_) {
+    if (control_) {
+        control_->IncreaseStrong();
+    }
+}
+template <typename T>
+ShardedSharedPtr<T>::ShardedSharedPtr(ShardedSharedPtr&& other)
+    : control_(other.control_), ptr_(other.ptr_) {
+    other.control_ = nullptr;
+    other.ptr_ = nullptr;
+}
+template <typename T>
+void ShardedSharedPtr<T>::Clear() {
+    if (control_) {
+        control_->DecreaseStrong();
+    }
+    control_ = nullptr;
+    ptr_ = nullptr;
+}
+template <typename T>
+ShardedSharedPtr<T>& ShardedSharedPtr<T>::operator=(const ShardedSharedPtr& other) {
+    if (&other == this) {
+        return *this;
+    }
+    Clear();
+    control_ = other.control_;
+    ptr_ = other.ptr_;
+    if (control_) {
+        control_->IncreaseStrong();
+    }
+    return *this;
+}
+template <typename T>
+ShardedSharedPtr<T>& ShardedSharedPtr<T>::operator=(ShardedSharedPtr&& other) {
+    if (&other == this) {
+        return *this;
+    }
+    Clear();
+    control_ = other.control_;
+    ptr_ = other.ptr_;
+    other.control_ = nullptr;
+    other.ptr_ = nullptr;
+    return *this;
+}
+template <typename T>
+ShardedSharedPtr<T>::~ShardedSharedPtr() {
+    Clear();
+}
+template <typename T>
+void ShardedSharedPtr<T>::Reset() {
+    Clear();
+}
+template <typename T>
+void ShardedSharedPtr<T>::Swap(ShardedSharedPtr& other) {
+    std::swap(control_, other.control_);
+    std::swap(ptr_, other.ptr_);
+}
+template <typename T>
+T* ShardedSharedPtr<T>::Get() const {
+    return ptr_;
+}
+template <typename T>
+T& ShardedSharedPtr<T>::operator*() const {
+    return *ptr_;
+}
+template <typename T>
+T* ShardedSharedPtr<T>::operator->() const {
+    return ptr_;
+}
+template <typename T>
+size_t ShardedSharedPtr<T>::UseCount() const {
+    return (control_ ? control_->GetCntStrong() : 0);
+}
+template <typename T>
+ShardedSharedPtr<T>::operator bool() const {
+    return control_ != nullptr;
+}
+
+// Move-only owner of a sharded object. Releasing it folds the per-thread counts; the object is
+// destroyed as soon as the last outstanding `ShardedSharedPtr` goes away after that.
+template <typename T>
+class ShardedOwner {
+public:
+    ShardedOwner();
+    explicit ShardedOwner(ShardedControlBlock<T>* block);
+    ShardedOwner(ShardedOwner&& other);
+    ShardedOwner& operator=(ShardedOwner&& other);
+    ShardedOwner(const ShardedOwner& other) = delete;
+    ShardedOwner& operator=(const ShardedOwner& other) = delete;
+    ~ShardedOwner();
+
+    void Reset();
+    ShardedSharedPtr<T> Share() const;
+
+    T* Get() const;
+    T& operator*() const;
+    T* operator->() const;
+    explicit operator bool() const;
+
+private:
+    ShardedControlBlock<T>* control_;
+};
+template <typename T>
+ShardedOwner<T>::ShardedOwner() : control_(nullptr) {
+}
+template <typename T>
+ShardedOwner<T>::ShardedOwner(ShardedControlBlock<T>* block) : control_(block) {
+}
+template <typename T>
+ShardedOwner<T>::ShardedOwner(ShardedOwner&& other) : control_(other.control_) {
+    other.control_ = nullptr;
+}
+template <typename T>
+ShardedOwner<T>& ShardedOwner<T>::operator=(ShardedOwner&& other) {
+    if (&other == this) {
+        return *this;
+    }
+    Reset();
+    control_ = other.control_;
+    other.control_ = nullptr;
+    return *this;
+}
+template <typename T>
+ShardedOwner<T>::~ShardedOwner() {
+    Reset();
+}
+template <typename T>
+void ShardedOwner<T>::Reset() {
+    if (control_) {
+        // Fold first, then drop the owner's own reference through the now exact count
+        control_->Kill();
+        control_->DecreaseStrong();
+    }
+    control_ = nullptr;
+}
+template <typename T>
+ShardedSharedPtr<T> ShardedOwner<T>::Share() const {
+    return (control_ ? ShardedSharedPtr<T>(control_) : ShardedSharedPtr<T>());
+}
+template <typename T>
+T* ShardedOwner<T>::Get() const {
+    return (control_ ? control_->GetPtr() : nullptr);
+}
+template <typename T>
+T& ShardedOwner<T>::operator*() const {
+    return *Get();
+}
+template <typename T>
+T* ShardedOwner<T>::operator->() const {
+    return Get();
+}
+template <typename T>
+ShardedOwner<T>::operator bool() const {
+    return control_ != nullptr;
+}
+
+template <typename T, typename... Args>
+ShardedOwner<T> MakeShardedShared(Args&&... args) {
+    return ShardedOwner<T>(new ShardedControlBlock<T>(std::forward<Args>(args)...));
+}
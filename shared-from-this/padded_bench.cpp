@@ -0,0 +1,73 @@
+// False sharing between counters and payload: reader threads loop over the fields of one shared
+// object while other threads copy and drop `SharedPtr`s to it. With `MakeShared` the counters
+// share a cache line with the fields, so every copy invalidates the readers' line; with
+// `MakeSharedPadded` they do not. Not part of any build:
+//     g++ -std=c++17 -O2 -pthread shared-from-this/padded_bench.cpp -o padded-bench
+//     ./padded-bench [readers] [copiers]
+// The numbers only mean something with a core per thread.
+
+#include "shared.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr auto kDuration = std::chrono::milliseconds(500);
+
+// Read-mostly settings, small enough to sit right after the counters
+struct Settings {
+    std::atomic<int> limits[4];
+};
+
+// Reads per second and per reader
+double ReadRate(const SharedPtr<Settings>& settings, int readers, int copiers) {
+    std::atomic<bool> stop{false};
+    std::atomic<long> reads{0};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < copiers; ++i) {
+        threads.emplace_back([&, local = settings] {
+            while (!stop.load(std::memory_order_relaxed)) {
+                SharedPtr<Settings> copy = local;
+            }
+        });
+    }
+    for (int i = 0; i < readers; ++i) {
+        threads.emplace_back([&] {
+            const Settings* object = settings.Get();
+            long count = 0;
+            long sum = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                for (const auto& limit : object->limits) {
+                    sum += limit.load(std::memory_order_relaxed);
+                }
+                ++count;
+            }
+            reads.fetch_add(sum == -1 ? 0 : count, std::memory_order_relaxed);
+        });
+    }
+    std::this_thread::sleep_for(kDuration);
+    stop.store(true);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::chrono::duration<double> seconds = kDuration;
+    return static_cast<double>(reads.load()) / seconds.count() / readers;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    int readers = argc > 1 ? std::atoi(argv[1]) : 4;
+    int copiers = argc > 2 ? std::atoi(argv[2]) : 4;
+
+    double fused = ReadRate(MakeShared<Settings>(), readers, copiers);
+    double padded = ReadRate(MakeSharedPadded<Settings>(), readers, copiers);
+    std::printf("%d readers, %d copiers: MakeShared %.1f M reads/s, MakeSharedPadded %.1f M "
+                "reads/s per reader\n",
+                readers, copiers, fused / 1e6, padded / 1e6);
+}
@@ -0,0 +1,532 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Policies `SharedPtr` and `WeakPtr` are parameterized with.
+//
+// A counting policy bundles the strong and weak count types of a control block and the lock
+// guarding its expiry listeners:
+//     `SingleThreadedCounts`: plain integers and no lock, for objects never shared across threads;
+//     `AtomicCounts`: atomics, the default;
+//     `BiasedCounts`: biased reference counting (Choi et al., PACT '18) for objects that are
+//         mostly copied by the thread that created them.
+// An allocation policy says where control blocks (and, with `MakeShared`, the objects) live:
+//     `HeapAllocation`: global `operator new`, the default;
+//     `ThreadCacheAllocation`: small blocks recycled through per-thread free lists.
+
+class ExpiryListener;
+
+// Policy-independent interface of control blocks, for code that has to reach a block without
+// knowing how it counts: expiry listeners and the biased count's merge queues.
+class ControlBlockRoot {
+public:
+    virtual ~ControlBlockRoot() = default;
+
+    // Destroys the object and drops the weak reference held by the strong ones
+    virtual void ReleaseLastStrong() = 0;
+    // Keep the block itself (not the object) allocated
+    virtual void PinBlock() = 0;
+    virtual void UnpinBlock() = 0;
+    virtual void RemoveExpiryListener(ExpiryListener* listener) = 0;
+};
+
+////////////////////////////////////////////////////////////
+
+// Counts are constructed with the block they belong to, which only `BiasedCount` makes use of.
+// All of them start at one.
+
+class PlainCount {
+public:
+    explicit PlainCount(ControlBlockRoot*) : value_(1) {
+    }
+    void Increase() {
+        ++value_;
+    }
+    // Returns `true` if this dropped the count to zero
+    bool Decrease() {
+        return --value_ == 0;
+    }
+    // Increases the count unless it is already zero
+    bool TryIncrease() {
+        if (value_ == 0) {
+            return false;
+        }
+        ++value_;
+        return true;
+    }
+    size_t Get() const {
+        return value_;
+    }
+    void Reset(size_t value) {
+        value_ = value;
+    }
+
+private:
+    size_t value_;
+};
+
+class AtomicCount {
+public:
+    explicit AtomicCount(ControlBlockRoot*) : value_(1) {
+    }
+    void Increase() {
+        value_.fetch_add(1, std::memory_order_relaxed);
+    }
+    bool Decrease() {
+        return value_.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+    bool TryIncrease() {
+        size_t value = value_.load(std::memory_order_relaxed);
+        while (value != 0) {
+            if (value_.compare_exchange_weak(value, value + 1, std::memory_order_acq_rel,
+                                             std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    size_t Get() const {
+        return value_.load(std::memory_order_acquire);
+    }
+    void Reset(size_t value) {
+        value_.store(value, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<size_t> value_;
+};
+
+class BiasedCount;
+
+// Per-thread part of biased counting: the blocks other threads found with a negative shared
+// count, waiting for their owner to merge its biased count into the shared one. Referenced by
+// the thread itself and by every block it owns; once the thread is gone, whoever finds such a
+// block negative merges it on the owner's behalf.
+class BiasedThreadState {
+public:
+    // The calling thread's state, or `nullptr` while the thread is exiting
+    static BiasedThreadState* Acquire();
+    static BiasedThreadState* Current();
+
+    void Ref();
+    void Unref();
+    // Hands `count` to its owner, or merges it right away if the owner has exited
+    void Enqueue(BiasedCount* count);
+    bool HasPending() const;
+    // Called by the owner only
+    void Drain();
+
+private:
+    struct Holder {
+        Holder();
+        ~Holder();
+        BiasedThreadState* state;
+    };
+
+    BiasedThreadState() = default;
+    static BiasedThreadState*& CurrentSlot();
+    static bool& ExitingFlag();
+
+    std::mutex mutex_;
+    std::vector<BiasedCount*> queue_;
+    std::atomic<bool> pending_{false};
+    bool exited_ = false;
+    std::atomic<size_t> refs_{1};
+};
+
+// Strong count split into a non-atomic part only the owning (creating) thread touches and an
+// atomic shared part for everybody else. The owner merges the two, marking the shared count with
+// `kMerged`, once its part drops to zero; only a merged count can be found zero. Non-owners that
+// drive an unmerged shared count negative queue the block to its owner, which merges it on its
+// next count operation or when it exits, so references created on one thread and dropped on
+// another are not leaked.
+class BiasedCount {
+public:
+    explicit BiasedCount(ControlBlockRoot* block);
+    BiasedCount(const BiasedCount& other) = delete;
+    BiasedCount& operator=(const BiasedCount& other) = delete;
+    ~BiasedCount();
+
+    void Increase();
+    bool Decrease();
+    bool TryIncrease();
+    // Exact on the owner thread, a racy snapshot elsewhere
+    size_t Get() const;
+    // Makes the calling thread the owner of a recycled block
+    void Reset(size_t value);
+
+private:
+    friend class BiasedThreadState;
+
+    static constexpr int64_t kMerged = int64_t{1} << 62;
+
+    bool IsOwner() const;
+    // Returns `true` if the count turned out to be zero
+    bool Merge();
+    void Adopt(BiasedThreadState* owner, size_t value);
+
+    ControlBlockRoot* block_;
+    BiasedThreadState* owner_;
+    // Written by the owner only, atomic so that `Get` may read it from other threads
+    std::atomic<size_t> biased_;
+    bool merged_;
+    std::atomic<int64_t> shared_;
+    std::atomic<bool> queued_;
+};
+
+inline BiasedThreadState*& BiasedThreadState::CurrentSlot() {
+    thread_local BiasedThreadState* state = nullptr;
+    return state;
+}
+inline bool& BiasedThreadState::ExitingFlag() {
+    thread_local bool exiting = false;
+    return exiting;
+}
+inline BiasedThreadState* BiasedThreadState::Current() {
+    return CurrentSlot();
+}
+inline BiasedThreadState* BiasedThreadState::Acquire() {
+    if (!CurrentSlot() && !ExitingFlag()) {
+        thread_local Holder holder;
+        static_cast<void>(holder);
+    }
+    return CurrentSlot();
+}
+inline BiasedThreadState::Holder::Holder() : state(new BiasedThreadState()) {
+    CurrentSlot() = state;
+}
+inline BiasedThreadState::Holder::~Holder() {
+    state->Drain();
+    // From here on this thread is a non-owner like any other, and blocks queued to the state
+    // are merged by whoever queues them
+    CurrentSlot() = nullptr;
+    ExitingFlag() = true;
+    {
+        std::lock_guard guard(state->mutex_);
+        state->exited_ = true;
+    }
+    state->Drain();
+    state->Unref();
+}
+inline void BiasedThreadState::Ref() {
+    refs_.fetch_add(1, std::memory_order_relaxed);
+}
+inline void BiasedThreadState::Unref() {
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete this;
+    }
+}
+inline bool BiasedThreadState::HasPending() const {
+    return pending_.load(std::memory_order_relaxed);
+}
+inline void BiasedThreadState::Enqueue(BiasedCount* count) {
+    count->block_->PinBlock();
+    bool zero = false;
+    {
+        std::lock_guard guard(mutex_);
+        if (!exited_) {
+            queue_.push_back(count);
+            pending_.store(true, std::memory_order_relaxed);
+            return;
+        }
+        // The owner is gone, so nobody else touches the biased part; the lock orders mergers
+        zero = count->Merge();
+    }
+    if (zero) {
+        count->block_->ReleaseLastStrong();
+    }
+    count->block_->UnpinBlock();
+}
+inline void BiasedThreadState::Drain() {
+    std::vector<BiasedCount*> queue;
+    {
+        std::lock_guard guard(mutex_);
+        queue.swap(queue_);
+        pending_.store(false, std::memory_order_relaxed);
+    }
+    for (BiasedCount* count : queue) {
+        if (count->Merge()) {
+            count->block_->ReleaseLastStrong();
+        }
+        count->block_->UnpinBlock();
+    }
+}
+
+inline BiasedCount::BiasedCount(ControlBlockRoot* block) : block_(block), owner_(nullptr) {
+    Adopt(BiasedThreadState::Acquire(), 1);
+}
+inline BiasedCount::~BiasedCount() {
+    if (owner_) {
+        owner_->Unref();
+    }
+}
+inline void BiasedCount::Adopt(BiasedThreadState* owner, size_t value) {
+    if (owner) {
+        owner->Ref();
+    }
+    if (owner_) {
+        owner_->Unref();
+    }
+    owner_ = owner;
+    queued_.store(false, std::memory_order_relaxed);
+    if (owner) {
+        biased_.store(value, std::memory_order_relaxed);
+        merged_ = false;
+        shared_.store(0, std::memory_order_relaxed);
+    } else {
+        // Created while the thread is exiting: everything goes through the shared part
+        biased_.store(0, std::memory_order_relaxed);
+        merged_ = true;
+        shared_.store(kMerged + static_cast<int64_t>(value), std::memory_order_relaxed);
+    }
+}
+inline void BiasedCount::Reset(size_t value) {
+    Adopt(BiasedThreadState::Acquire(), value);
+}
+inline bool BiasedCount::IsOwner() const {
+    return owner_ && owner_ == BiasedThreadState::Current();
+}
+inline bool BiasedCount::Merge() {
+    if (merged_) {
+        return false;
+    }
+    merged_ = true;
+    auto biased = static_cast<int64_t>(biased_.load(std::memory_order_relaxed));
+    biased_.store(0, std::memory_order_relaxed);
+    return shared_.fetch_add(kMerged + biased, std::memory_order_acq_rel) + biased == 0;
+}
+inline void BiasedCount::Increase() {
+    if (IsOwner()) {
+        if (owner_->HasPending()) {
+            owner_->Drain();
+        }
+        if (!merged_) {
+            biased_.store(biased_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+    }
+    shared_.fetch_add(1, std::memory_order_relaxed);
+}
+inline bool BiasedCount::Decrease() {
+    if (IsOwner()) {
+        if (owner_->HasPending()) {
+            owner_->Drain();
+        }
+        if (!merged_) {
+            size_t biased = biased_.load(std::memory_order_relaxed) - 1;
+            biased_.store(biased, std::memory_order_relaxed);
+            return biased == 0 && Merge();
+        }
+    }
+    int64_t shared = shared_.fetch_sub(1, std::memory_order_acq_rel) - 1;
+    if (shared == kMerged) {
+        return true;
+    }
+    if (shared < 0 && !queued_.exchange(true, std::memory_order_relaxed)) {
+        owner_->Enqueue(this);
+    }
+    return false;
+}
+inline bool BiasedCount::TryIncrease() {
+    // An unmerged count is never destroyed, whatever its parts add up to
+    if (IsOwner() && !merged_) {
+        biased_.store(biased_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return true;
+    }
+    int64_t shared = shared_.load(std::memory_order_relaxed);
+    while (shared != kMerged) {
+        if (shared_.compare_exchange_weak(shared, shared + 1, std::memory_order_acq_rel,
+                                          std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+inline size_t BiasedCount::Get() const {
+    int64_t shared = shared_.load(std::memory_order_acquire);
+    if (shared >= kMerged / 2) {
+        return static_cast<size_t>(shared - kMerged);
+    }
+    auto total = static_cast<int64_t>(biased_.load(std::memory_order_relaxed)) + shared;
+    return total > 0 ? static_cast<size_t>(total) : 0;
+}
+
+////////////////////////////////////////////////////////////
+
+class NullLock {
+public:
+    void lock() {
+    }
+    void unlock() {
+    }
+};
+
+class SpinLock {
+public:
+    void lock() {
+        while (flag_.test_and_set(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    }
+    void unlock() {
+        flag_.clear(std::memory_order_release);
+    }
+
+private:
+    std::atomic_flag flag_ = ATOMIC_FLAG_INIT;
+};
+
+struct SingleThreadedCounts {
+    using StrongCount = PlainCount;
+    using WeakCount = PlainCount;
+    using Lock = NullLock;
+};
+
+struct AtomicCounts {
+    using StrongCount = AtomicCount;
+    using WeakCount = AtomicCount;
+    using Lock = SpinLock;
+};
+
+// Weak references are rare enough to stay plain atomics. Objects created on a thread and last
+// released on others are reclaimed by their creator, on its next count operation; threads that
+// may go idle for long should call `MergePending` now and then.
+struct BiasedCounts {
+    using StrongCount = BiasedCount;
+    using WeakCount = AtomicCount;
+    using Lock = SpinLock;
+
+    // Merges the calling thread's queued blocks, destroying those that turn out unreferenced
+    static void MergePending() {
+        BiasedThreadState* state = BiasedThreadState::Current();
+        if (state && state->HasPending()) {
+            state->Drain();
+        }
+    }
+};
+
+////////////////////////////////////////////////////////////
+
+struct HeapAllocation {
+    static void* Allocate(size_t size, size_t alignment) {
+        if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+            return ::operator new(size, std::align_val_t(alignment));
+        }
+        return ::operator new(size);
+    }
+    static void Deallocate(void* ptr, size_t size, size_t alignment) {
+        if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+            ::operator delete(ptr, size, std::align_val_t(alignment));
+        } else {
+            ::operator delete(ptr, size);
+        }
+    }
+};
+
+// Small blocks go through per-thread free lists with one size class per 16 bytes, so creating
+// and dropping pointers mostly stays away from the global allocator. A block freed by another
+// thread than the one that allocated it just joins the freeing thread's list; every list keeps
+// at most `kMaxCached` blocks and returns the rest to the heap.
+class ThreadCacheAllocation {
+public:
+    static void* Allocate(size_t size, size_t alignment);
+    static void Deallocate(void* ptr, size_t size, size_t alignment);
+
+private:
+    static constexpr size_t kGranularity = 16;
+    static constexpr size_t kMaxSize = 256;
+    static constexpr size_t kMaxCached = 64;
+    static constexpr size_t kClasses = kMaxSize / kGranularity;
+
+    struct FreeNode {
+        FreeNode* next;
+    };
+    struct Cache {
+        explicit Cache(bool* destroyed);
+        ~Cache();
+
+        FreeNode* heads[kClasses] = {};
+        size_t counts[kClasses] = {};
+        bool* destroyed;
+    };
+
+    static bool IsCached(size_t size, size_t alignment);
+    // `nullptr` once the thread's cache has been destroyed on exit
+    static Cache* ThreadCache();
+};
+inline ThreadCacheAllocation::Cache::Cache(bool* destroyed) : destroyed(destroyed) {
+}
+inline ThreadCacheAllocation::Cache::~Cache() {
+    for (size_t i = 0; i < kClasses; ++i) {
+        while (heads[i]) {
+            FreeNode* node = heads[i];
+            heads[i] = node->next;
+            ::operator delete(node, (i + 1) * kGranularity);
+        }
+    }
+    *destroyed = true;
+}
+inline ThreadCacheAllocation::Cache* ThreadCacheAllocation::ThreadCache() {
+    thread_local bool destroyed = false;
+    if (destroyed) {
+        return nullptr;
+    }
+    thread_local Cache cache(&destroyed);
+    return &cache;
+}
+inline bool ThreadCacheAllocation::IsCached(size_t size, size_t alignment) {
+    return size <= kMaxSize && alignment <= kGranularity &&
+           kGranularity <= __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+}
+inline void* ThreadCacheAllocation::Allocate(size_t size, size_t alignment) {
+    if (!IsCached(size, alignment)) {
+        return HeapAllocation::Allocate(size, alignment);
+    }
+    size_t index = (size + kGranularity - 1) / kGranularity - 1;
+    Cache* cache = ThreadCache();
+    if (cache && cache->heads[index]) {
+        FreeNode* node = cache->heads[index];
+        cache->heads[index] = node->next;
+        --cache->counts[index];
+        return node;
+    }
+    return ::operator new((index + 1) * kGranularity);
+}
+inline void ThreadCacheAllocation::Deallocate(void* ptr, size_t size, size_t alignment) {
+    if (!IsCached(size, alignment)) {
+        HeapAllocation::Deallocate(ptr, size, alignment);
+        return;
+    }
+    size_t index = (size + kGranularity - 1) / kGranularity - 1;
+    Cache* cache = ThreadCache();
+    if (cache && cache->counts[index] < kMaxCached) {
+        cache->heads[index] = new (ptr) FreeNode{cache->heads[index]};
+        ++cache->counts[index];
+        return;
+    }
+    ::operator delete(ptr, (index + 1) * kGranularity);
+}
+
+// Routes the allocation of a control block class through an allocation policy
+template <typename Allocation>
+struct AllocatedBy {
+    static void* operator new(size_t size) {
+        return Allocation::Allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+    }
+    static void* operator new(size_t size, std::align_val_t alignment) {
+        return Allocation::Allocate(size, static_cast<size_t>(alignment));
+    }
+    static void operator delete(void* ptr, size_t size) {
+        Allocation::Deallocate(ptr, size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+    }
+    static void operator delete(void* ptr, size_t size, std::align_val_t alignment) {
+        Allocation::Deallocate(ptr, size, static_cast<size_t>(alignment));
+    }
+};
@@ -6,15 +6,26 @@
 #include <type_traits>
 #include <utility>
 
-template <typename T>
+// `Counts` picks how the control block counts references (see policies.h): the default is
+// thread-safe, `SingleThreadedCounts` skips atomics altogether for objects that never leave
+// their thread. `Allocation` picks where blocks made by this pointer are allocated. Pointers
+// with different policies do not convert into each other.
+template <typename T, typename Counts, typename Allocation>
 class SharedPtr {
 public:
-    template <typename Y>
+    template <typename Y, typename C, typename A>
     friend class SharedPtr;
-    template <typename Y>
+    template <typename Y, typename C, typename A>
     friend class WeakPtr;
-    template <typename K, typename S>
-    friend inline bool operator==(const SharedPtr<K>& left, const SharedPtr<S>& right);
+    friend class OutputArchive;
+    template <typename K, typename S, typename C, typename A>
+    friend inline bool operator==(const SharedPtr<K, C, A>& left, const SharedPtr<S, C, A>& right);
+    template <typename Y, typename C, typename A, typename... Args>
+    friend SharedPtr<Y, C, A> BasicMakeShared(Args&&... args);
+    template <typename Y, size_t Alignment, typename C, typename A, typename... Args>
+    friend SharedPtr<Y, C, A> BasicMakeSharedAligned(Args&&... args);
+
+    using Block = BasicControlBlock<Counts>;
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Constructors
 
@@ -30,20 +41,23 @@ public:
     // Aliasing constructor
     // #8 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
     template <typename Y>
-    SharedPtr(const SharedPtr<Y>& other, T* ptr);
+    SharedPtr(const SharedPtr<Y, Counts, Allocation>& other, T* ptr);
+    // Takes `other`'s reference over instead of adding one
+    template <typename Y>
+    SharedPtr(SharedPtr<Y, Counts, Allocation>&& other, T* ptr);
 
     template <typename Y>
-    SharedPtr(const SharedPtr<Y>& other);
+    SharedPtr(const SharedPtr<Y, Counts, Allocation>& other);
 
     template <typename Y>
-    SharedPtr(SharedPtr<Y>&& other);
+    SharedPtr(SharedPtr<Y, Counts, Allocation>&& other);
 
-    SharedPtr(T* ptr, ControlBlockBase* block);
+    SharedPtr(T* ptr, Block* block);
 
     // Promote `WeakPtr`
     // #11 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
     //    template <typename Y>
-    explicit SharedPtr(const WeakPtr<T>& other);
+    explicit SharedPtr(const WeakPtr<T, Counts, Allocation>& other);
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // `operator=`-s
@@ -78,6 +92,13 @@ public:
     size_t UseCount() const;
     explicit operator bool() const;
 
+    // Runs `listener` once the object dies; `false` if there is no live object to watch
+    bool OnExpire(ExpiryListener& listener) const;
+
+    // Identifies the control block: the same for every pointer sharing ownership of an object,
+    // aliased or expired ones included, and `nullptr` for empty pointers
+    const void* OwnerId() const;
+
 private:
     void ControlIncreaseStrong();
     void ControlDecreaseStrong();
@@ -85,65 +106,78 @@ private:
     void Clear();
 
     template <typename Y>
-    void InitWeakThis(EnableSharedFromThis<Y>* e);
+    void InitWeakThis(EnableSharedFromThis<Y, Counts, Allocation>* e);
 
-    void PerhapsInitWeakThis();
-    ControlBlockBase* control_;
+    // Called only where a control block takes ownership of a fresh object (raw pointer adoption
+    // and `MakeShared`), never on copies, so copying costs the same as for plain types
+    template <typename Y>
+    void PerhapsInitWeakThis(Y* ptr);
+    Block* control_;
     T* ptr_;
 };
-template <typename T>
-SharedPtr<T>::SharedPtr() : control_(nullptr), ptr_(nullptr) {
-    PerhapsInitWeakThis();
+template <typename T, typename Counts, typename Allocation>
+SharedPtr<T, Counts, Allocation>::SharedPtr() : control_(nullptr), ptr_(nullptr) {
 }
-template <typename T>
-SharedPtr<T>::SharedPtr(std::nullptr_t) : control_(nullptr), ptr_(nullptr) {
-    PerhapsInitWeakThis();
+template <typename T, typename Counts, typename Allocation>
+SharedPtr<T, Counts, Allocation>::SharedPtr(std::nullptr_t) : control_(nullptr), ptr_(nullptr) {
 }
-template <typename T>
+template <typename T, typename Counts, typename Allocation>
 template <typename Y>
-SharedPtr<T>::SharedPtr(Y* ptr) : control_(new ControlBlockPointer(ptr)), ptr_(ptr) {
-    PerhapsInitWeakThis();
-}
-template <typename T>
-SharedPtr<T>::SharedPtr(const SharedPtr& other) : control_(other.control_), ptr_(other.ptr_) {
+SharedPtr<T, Counts, Allocation>::SharedPtr(Y* ptr)
+    : control_(new ControlBlockPointer<Y, Counts, Allocation>(ptr)), ptr_(ptr) {
+    SMART_PTR_HEAP_SAMPLE(
+        control_, sizeof(ControlBlockPointer<Y, Counts, Allocation>) + (ptr ? sizeof(Y) : 0));
+    PerhapsInitWeakThis(ptr);
+}
+template <typename T, typename Counts, typename Allocation>
+SharedPtr<T, Counts, Allocation>::SharedPtr(const SharedPtr& other)
+    : control_(other.control_), ptr_(other.ptr_) {
     ControlIncreaseStrong();
-    PerhapsInitWeakThis();
 }
-template <typename T>
-SharedPtr<T>::SharedPtr(SharedPtr&& other) : control_(other.control_), ptr_(other.ptr_) {
+template <typename T, typename Counts, typename Allocation>
+SharedPtr<T, Counts, Allocation>::SharedPtr(SharedPtr&& other)
+    : control_(other.control_), ptr_(other.ptr_) {
     other.control_ = nullptr;
     other.ptr_ = nullptr;
 }
-template <typename T>
+template <typename T, typename Counts, typename Allocation>
 template <typename Y>
-SharedPtr<T>::SharedPtr(const SharedPtr<Y>& other) : control_(other.control_), ptr_(other.ptr_) {
+SharedPtr<T, Counts, Allocation>::SharedPtr(const SharedPtr<Y, Counts, Allocation>& other)
+    : control_(other.control_), ptr_(other.ptr_) {
     ControlIncreaseStrong();
-    PerhapsInitWeakThis();
 }
-template <typename T>
+template <typename T, typename Counts, typename Allocation>
 template <typename Y>
-SharedPtr<T>::SharedPtr(SharedPtr<Y>&& other) : control_(other.control_), ptr_(other.ptr_) {
+SharedPtr<T, Counts, Allocation>::SharedPtr(SharedPtr<Y, Counts, Allocation>&& other)
+    : control_(other.control_), ptr_(other.ptr_) {
     other.control_ = nullptr;
     other.ptr_ = nullptr;
 }
-template <typename T>
+template <typename T, typename Counts, typename Allocation>
 template <typename Y>
-SharedPtr<T>::SharedPtr(const SharedPtr<Y>& other, T* ptr) : control_(other.control_), ptr_(ptr) {
+SharedPtr<T, Counts, Allocation>::SharedPtr(const SharedPtr<Y, Counts, Allocation>& other, T* ptr)
+    : control_(other.control_), ptr_(ptr) {
     ControlIncreaseStrong();
-    PerhapsInitWeakThis();
 }
-template <typename T>
-SharedPtr<T>::SharedPtr(T* ptr, ControlBlockBase* block) : control_(block), ptr_(ptr) {
-    PerhapsInitWeakThis();
+template <typename T, typename Counts, typename Allocation>
+template <typename Y>
+SharedPtr<T, Counts, Allocation>::SharedPtr(SharedPtr<Y, Counts, Allocation>&& other, T* ptr)
+    : control_(other.control_), ptr_(ptr) {
+    other.control_ = nullptr;
+    other.ptr_ = nullptr;
+}
+template <typename T, typename Counts, typename Allocation>
+SharedPtr<T, Counts, Allocation>::SharedPtr(T* ptr, Block* block) : control_(block), ptr_(ptr) {
 }
-template <typename T>
-void SharedPtr<T>::Clear() {
+template <typename T, typename Counts, typename Allocation>
+void SharedPtr<T, Counts, Allocation>::Clear() {
     ControlDecreaseStrong();
     control_ = nullptr;
     ptr_ = nullptr;
 }
-template <typename T>
-SharedPtr<T>& SharedPtr<T>::operator=(const SharedPtr& other) {
+template <typename T, typename Counts, typename Allocation>
+SharedPtr<T, Counts, Allocation>& SharedPtr<T, Counts, Allocation>::operator=(
+    const SharedPtr& other) {
     if (&other == this) {
         return *this;
     }
@@ -153,8 +187,8 @@ SharedPtr<T>& SharedPtr<T>::operator=(const SharedPtr& other) {
     ControlIncreaseStrong();
     return *this;
 }
-template <typename T>
-SharedPtr<T>& SharedPtr<T>::operator=(SharedPtr&& other) {
+template <typename T, typename Counts, typename Allocation>
+SharedPtr<T, Counts, Allocation>& SharedPtr<T, Counts, Allocation>::operator=(SharedPtr&& other) {
     if (&other == this) {
         return *this;
     }
@@ -165,121 +199,218 @@ SharedPtr<T>& SharedPtr<T>::operator=(SharedPtr&& other) {
     other.ptr_ = nullptr;
     return *this;
 }
-template <typename T>
-SharedPtr<T>::~SharedPtr() {
+template <typename T, typename Counts, typename Allocation>
+SharedPtr<T, Counts, Allocation>::~SharedPtr() {
     Clear();
 }
-template <typename T>
-void SharedPtr<T>::Reset() {
+template <typename T, typename Counts, typename Allocation>
+void SharedPtr<T, Counts, Allocation>::Reset() {
     Clear();
 }
-template <typename T>
+template <typename T, typename Counts, typename Allocation>
 template <typename Y>
-void SharedPtr<T>::Reset(Y* ptr) {
+void SharedPtr<T, Counts, Allocation>::Reset(Y* ptr) {
     Clear();
-    *this = std::move(SharedPtr<Y>(ptr));
+    *this = std::move(SharedPtr<Y, Counts, Allocation>(ptr));
 }
-template <typename T>
-void SharedPtr<T>::Swap(SharedPtr& other) {
+template <typename T, typename Counts, typename Allocation>
+void SharedPtr<T, Counts, Allocation>::Swap(SharedPtr& other) {
     SharedPtr tmp = std::move(*this);
     *this = std::move(other);
     other = std::move(tmp);
 }
-template <typename T>
-T* SharedPtr<T>::Get() const {
+template <typename T, typename Counts, typename Allocation>
+T* SharedPtr<T, Counts, Allocation>::Get() const {
     return ptr_;
 }
-template <typename T>
-T& SharedPtr<T>::operator*() const {
+template <typename T, typename Counts, typename Allocation>
+T& SharedPtr<T, Counts, Allocation>::operator*() const {
     return *ptr_;
 }
-template <typename T>
-T* SharedPtr<T>::operator->() const {
+template <typename T, typename Counts, typename Allocation>
+T* SharedPtr<T, Counts, Allocation>::operator->() const {
     return ptr_;
 }
-template <typename T>
-size_t SharedPtr<T>::UseCount() const {
+template <typename T, typename Counts, typename Allocation>
+size_t SharedPtr<T, Counts, Allocation>::UseCount() const {
     return ControlGetCntStrong();
 }
-template <typename T>
-SharedPtr<T>::operator bool() const {
+template <typename T, typename Counts, typename Allocation>
+SharedPtr<T, Counts, Allocation>::operator bool() const {
     return control_ != nullptr;
 }
-template <typename T>
-void SharedPtr<T>::ControlIncreaseStrong() {
+template <typename T, typename Counts, typename Allocation>
+bool SharedPtr<T, Counts, Allocation>::OnExpire(ExpiryListener& listener) const {
+    return control_ && control_->AddExpiryListener(&listener);
+}
+template <typename T, typename Counts, typename Allocation>
+const void* SharedPtr<T, Counts, Allocation>::OwnerId() const {
+    return control_;
+}
+template <typename T, typename Counts, typename Allocation>
+void SharedPtr<T, Counts, Allocation>::ControlIncreaseStrong() {
     if (control_) {
         control_->IncreaseStrong();
     }
 }
-template <typename T>
-void SharedPtr<T>::ControlDecreaseStrong() {
+template <typename T, typename Counts, typename Allocation>
+void SharedPtr<T, Counts, Allocation>::ControlDecreaseStrong() {
     if (control_) {
         control_->DecreaseStrong();
     }
 }
-template <typename T>
-int SharedPtr<T>::ControlGetCntStrong() const {
+template <typename T, typename Counts, typename Allocation>
+int SharedPtr<T, Counts, Allocation>::ControlGetCntStrong() const {
     return (control_ ? control_->GetCntStrong() : 0);
 }
-template <typename T>
+template <typename T, typename Counts, typename Allocation>
 // template <typename Y>
-SharedPtr<T>::SharedPtr(const WeakPtr<T>& other) {
-    if (!other.control_ || !other.control_->IsResourceAlive()) {
+SharedPtr<T, Counts, Allocation>::SharedPtr(const WeakPtr<T, Counts, Allocation>& other) {
+    if (!other.control_ || !other.control_->TryIncreaseStrong()) {
         throw BadWeakPtr();
     }
     control_ = other.control_;
     ptr_ = other.ptr_;
-    ControlIncreaseStrong();
 }
-template <typename T>
+template <typename T, typename Counts, typename Allocation>
 template <typename Y>
-void SharedPtr<T>::InitWeakThis(EnableSharedFromThis<Y>* e) {
-    e->weak_this_ = *this;
+void SharedPtr<T, Counts, Allocation>::InitWeakThis(
+    EnableSharedFromThis<Y, Counts, Allocation>* e) {
+    if (e->weak_this_.Expired()) {
+        e->weak_this_ = SharedPtr<Y, Counts, Allocation>(*this, static_cast<Y*>(e));
+    }
+}
+template <typename T, typename Counts, typename Allocation>
+template <typename Y>
+void SharedPtr<T, Counts, Allocation>::PerhapsInitWeakThis(Y* ptr) {
+    if constexpr (std::is_base_of_v<EnableSharedFromThisBase, std::remove_cv_t<Y>>) {
+        if (ptr) {
+            InitWeakThis(const_cast<std::remove_cv_t<Y>*>(ptr));
+        }
+    }
 }
-template <typename T>
-void SharedPtr<T>::PerhapsInitWeakThis() {
-    if constexpr (std::is_convertible_v<T, EnableSharedFromThisBase>) {
-        InitWeakThis(this->ptr_);
+
+// `MakeShared` for pointers with non-default policies, e.g.
+//     BasicMakeShared<Node, SingleThreadedCounts, ThreadCacheAllocation>(args...)
+template <typename T, typename Counts, typename Allocation, typename... Args>
+SharedPtr<T, Counts, Allocation> BasicMakeShared(Args&&... args);
+
+template <typename T, size_t Alignment, typename Counts, typename Allocation, typename... Args>
+SharedPtr<T, Counts, Allocation> BasicMakeSharedAligned(Args&&... args) {
+    auto block = new ControlBlockEmplaceAligned<T, Alignment, Counts, Allocation>(
+        std::forward<Args>(args)...);
+    SMART_PTR_HEAP_SAMPLE(block, sizeof(*block));
+    SharedPtr<T, Counts, Allocation> result(block->GetPtr(), block);
+    result.PerhapsInitWeakThis(result.ptr_);
+    return result;
+}
+
+// `MakeShared` for over-aligned payloads, e.g. SIMD buffers: the object starts on an
+// `Alignment` boundary no matter what `alignof(T)` says
+template <typename T, size_t Alignment = kSimdAlignment, typename... Args>
+SharedPtr<T> MakeSharedAligned(Args&&... args) {
+    return BasicMakeSharedAligned<T, Alignment, AtomicCounts, HeapAllocation>(
+        std::forward<Args>(args)...);
+}
+
+// `MakeShared` with the counters on a cache line of their own, so that threads copying and
+// dropping pointers do not keep invalidating the lines readers of the object are working on.
+// Costs up to a cache line of padding on each side of the object.
+template <typename T, typename... Args>
+SharedPtr<T> MakeSharedPadded(Args&&... args) {
+    return MakeSharedAligned<T, kPaddedAlignment<T>>(std::forward<Args>(args)...);
+}
+
+template <typename T, typename Counts, typename Allocation, typename... Args>
+SharedPtr<T, Counts, Allocation> BasicMakeShared(Args&&... args) {
+    if constexpr (PadSharedCounters<T>::value) {
+        return BasicMakeSharedAligned<T, kPaddedAlignment<T>, Counts, Allocation>(
+            std::forward<Args>(args)...);
+    } else {
+        auto block = new ControlBlockEmplace<T, Counts, Allocation>(std::forward<Args>(args)...);
+        SMART_PTR_HEAP_SAMPLE(block, sizeof(*block));
+        SharedPtr<T, Counts, Allocation> result(block->GetPtr(), block);
+        result.PerhapsInitWeakThis(result.ptr_);
+        return result;
     }
 }
 
 template <typename T, typename... Args>
 SharedPtr<T> MakeShared(Args&&... args) {
-    auto block = new ControlBlockEmplace<T>(std::forward<Args>(args)...);
-    return SharedPtr<T>(block->GetPtr(), block);
+    return BasicMakeShared<T, AtomicCounts, HeapAllocation>(std::forward<Args>(args)...);
 }
 
-template <typename K, typename S>
-inline bool operator==(const SharedPtr<K>& left, const SharedPtr<S>& right) {
+// Casts sharing ownership with `ptr`, built on the aliasing constructors. The rvalue overloads
+// take `ptr`'s reference over, so casting a pointer that is about to be dropped costs no counter
+// traffic; a failed `DynamicPointerCast` leaves `ptr` as it was.
+template <typename T, typename Y, typename C, typename A>
+SharedPtr<T, C, A> StaticPointerCast(const SharedPtr<Y, C, A>& ptr) {
+    return SharedPtr<T, C, A>(ptr, static_cast<T*>(ptr.Get()));
+}
+template <typename T, typename Y, typename C, typename A>
+SharedPtr<T, C, A> StaticPointerCast(SharedPtr<Y, C, A>&& ptr) {
+    T* cast = static_cast<T*>(ptr.Get());
+    return SharedPtr<T, C, A>(std::move(ptr), cast);
+}
+template <typename T, typename Y, typename C, typename A>
+SharedPtr<T, C, A> DynamicPointerCast(const SharedPtr<Y, C, A>& ptr) {
+    if (T* cast = dynamic_cast<T*>(ptr.Get())) {
+        return SharedPtr<T, C, A>(ptr, cast);
+    }
+    return SharedPtr<T, C, A>();
+}
+template <typename T, typename Y, typename C, typename A>
+SharedPtr<T, C, A> DynamicPointerCast(SharedPtr<Y, C, A>&& ptr) {
+    if (T* cast = dynamic_cast<T*>(ptr.Get())) {
+        return SharedPtr<T, C, A>(std::move(ptr), cast);
+    }
+    return SharedPtr<T, C, A>();
+}
+template <typename T, typename Y, typename C, typename A>
+SharedPtr<T, C, A> ConstPointerCast(const SharedPtr<Y, C, A>& ptr) {
+    return SharedPtr<T, C, A>(ptr, const_cast<T*>(ptr.Get()));
+}
+template <typename T, typename Y, typename C, typename A>
+SharedPtr<T, C, A> ConstPointerCast(SharedPtr<Y, C, A>&& ptr) {
+    T* cast = const_cast<T*>(ptr.Get());
+    return SharedPtr<T, C, A>(std::move(ptr), cast);
+}
+
+template <typename K, typename S, typename C, typename A>
+inline bool operator==(const SharedPtr<K, C, A>& left, const SharedPtr<S, C, A>& right) {
     return left.control_ && right.control_ && left.control_ == right.control_;
 }
 
 class EnableSharedFromThisBase {};
 
-template <typename T>
+// Objects must be owned through pointers with the same policies as given here
+template <typename T, typename Counts, typename Allocation>
 class EnableSharedFromThis : public EnableSharedFromThisBase {
 public:
-    SharedPtr<T> SharedFromThis();
-    SharedPtr<const T> SharedFromThis() const;
+    SharedPtr<T, Counts, Allocation> SharedFromThis();
+    SharedPtr<const T, Counts, Allocation> SharedFromThis() const;
 
-    WeakPtr<T> WeakFromThis() noexcept;
-    WeakPtr<const T> WeakFromThis() const noexcept;
+    WeakPtr<T, Counts, Allocation> WeakFromThis() noexcept;
+    WeakPtr<const T, Counts, Allocation> WeakFromThis() const noexcept;
     // private:
-    WeakPtr<T> weak_this_;
+    WeakPtr<T, Counts, Allocation> weak_this_;
 };
-template <typename T>
-SharedPtr<T> EnableSharedFromThis<T>::SharedFromThis() {
-    return SharedPtr<T>(weak_this_);
-}
-template <typename T>
-SharedPtr<const T> EnableSharedFromThis<T>::SharedFromThis() const {
-    return SharedPtr<const T>(weak_this_);
-}
-template <typename T>
-WeakPtr<T> EnableSharedFromThis<T>::WeakFromThis() noexcept {
-    return WeakPtr<T>(weak_this_);
-}
-template <typename T>
-WeakPtr<const T> EnableSharedFromThis<T>::WeakFromThis() const noexcept {
-    return WeakPtr<const T>(weak_this_);
+template <typename T, typename Counts, typename Allocation>
+SharedPtr<T, Counts, Allocation> EnableSharedFromThis<T, Counts, Allocation>::SharedFromThis() {
+    return SharedPtr<T, Counts, Allocation>(weak_this_);
+}
+template <typename T, typename Counts, typename Allocation>
+SharedPtr<const T, Counts, Allocation> EnableSharedFromThis<T, Counts, Allocation>::SharedFromThis()
+    const {
+    return SharedPtr<const T, Counts, Allocation>(weak_this_);
+}
+template <typename T, typename Counts, typename Allocation>
+WeakPtr<T, Counts, Allocation>
+EnableSharedFromThis<T, Counts, Allocation>::WeakFromThis() noexcept {
+    return WeakPtr<T, Counts, Allocation>(weak_this_);
+}
+template <typename T, typename Counts, typename Allocation>
+WeakPtr<const T, Counts, Allocation> EnableSharedFromThis<T, Counts, Allocation>::WeakFromThis()
+    const noexcept {
+    return WeakPtr<const T, Counts, Allocation>(weak_this_);
 }
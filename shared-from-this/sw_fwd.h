@@ -1,60 +1,265 @@
 #pragma once
 
+#include "policies.h"
+#include "../trace/hooks.h"
+
+#include <atomic>
 #include <exception>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <typeinfo>
 
 ////////////////////////////////////////////////////////////
 
 class EnableSharedFromThisBase;
 
-template <typename T>
+template <typename T, typename Counts = AtomicCounts, typename Allocation = HeapAllocation>
 class EnableSharedFromThis;
 
-class ControlBlockBase {
+template <typename Counts>
+class BasicControlBlock;
+
+// Callback run once when the strong count of a control block reaches zero, right after the
+// object is destroyed. The listener is owned by the caller and linked into the block in place,
+// so registering allocates nothing; it doubles as the token for unregistering, which also
+// happens on destruction. A listener is unlinked before it fires; unregistering or destroying it
+// from another thread while its callback runs waits for the callback to return.
+//
+// The block must stay allocated for as long as the listener may be registered: keep a
+// `WeakPtr` to the object if the listener can outlive it or be dropped from another thread.
+class ExpiryListener {
+public:
+    using Callback = void (*)(void* context);
+
+    ExpiryListener(Callback callback, void* context);
+    ExpiryListener(const ExpiryListener& other) = delete;
+    ExpiryListener& operator=(const ExpiryListener& other) = delete;
+    ~ExpiryListener();
+
+    void Unregister();
+    bool IsRegistered() const;
+
+private:
+    template <typename Counts>
+    friend class BasicControlBlock;
+
+    Callback callback_;
+    void* context_;
+    std::atomic<ControlBlockRoot*> block_;
+    ExpiryListener* prev_;
+    ExpiryListener* next_;
+};
+
+// Strong references collectively hold one weak reference: the last strong release destroys the
+// payload and then drops that weak reference, so the block is freed by whichever decrement
+// brings the weak count to zero and nothing else needs to re-check both counts.
+template <typename Counts>
+class BasicControlBlock : public ControlBlockRoot {
 public:
-    ControlBlockBase() : cnt_strong_ref_(1), cnt_weak_ref_(0), destruction_is_locked_(false) {
+    BasicControlBlock() : strong_(this), weak_(this), listeners_(nullptr), firing_(nullptr) {
     }
-    virtual ~ControlBlockBase() = default;
     void IncreaseStrong() {
-        ++cnt_strong_ref_;
+        strong_.Increase();
     }
     virtual void DeleteSource() = 0;
+    // Address of the object the block owns, null once it is gone or if the block cannot tell
+    virtual const void* Source() const {
+        return nullptr;
+    }
+    // Type the block created the object as, null if it cannot tell
+    virtual const std::type_info* SourceType() const {
+        return nullptr;
+    }
     void DecreaseStrong() {
-        --cnt_strong_ref_;
-        if (cnt_strong_ref_ == 0) {
-            destruction_is_locked_ = true;
-            DeleteSource();
-            destruction_is_locked_ = false;
-        }
-        if (!destruction_is_locked_ && cnt_strong_ref_ == 0 && cnt_weak_ref_ == 0) {
-            delete this;
+        if (strong_.Decrease()) {
+            BasicControlBlock::ReleaseLastStrong();
         }
     }
-    int GetCntStrong() const {
-        return cnt_strong_ref_;
+    // Increases the strong count unless the object is already gone
+    bool TryIncreaseStrong() {
+        return strong_.TryIncrease();
+    }
+    size_t GetCntStrong() const {
+        return strong_.Get();
     }
     void IncreaseWeak() {
-        ++cnt_weak_ref_;
+        weak_.Increase();
     }
     void DecreaseWeak() {
-        --cnt_weak_ref_;
-        if (!destruction_is_locked_ && cnt_strong_ref_ == 0 && cnt_weak_ref_ == 0) {
-            delete this;
+        if (weak_.Decrease()) {
+            DeleteBlock();
         }
     }
     bool IsResourceAlive() const {
-        return cnt_strong_ref_ != 0;
+        return strong_.Get() != 0;
+    }
+
+    // Returns `false` and links nothing if the object is already gone
+    bool AddExpiryListener(ExpiryListener* listener);
+    void RemoveExpiryListener(ExpiryListener* listener) override;
+#ifdef SMART_PTR_HEAP_PROFILE
+    HeapSampleSlot& HeapProfileSlot() {
+        return heap_sample_;
+    }
+#endif
+
+protected:
+    // Called once both counts are zero; blocks that are recycled instead of freed override it
+    virtual void DeleteBlock() {
+        delete this;
+    }
+    // Brings a recycled block back to the state of a freshly created one
+    void ResetCounts() {
+        strong_.Reset(1);
+        weak_.Reset(1);
     }
 
 private:
-    size_t cnt_strong_ref_;
-    size_t cnt_weak_ref_;
-    bool destruction_is_locked_;
+    void ReleaseLastStrong() override {
+        DeleteSource();
+        NotifyExpired();
+        DecreaseWeak();
+    }
+    void PinBlock() override {
+        IncreaseWeak();
+    }
+    void UnpinBlock() override {
+        DecreaseWeak();
+    }
+    // The listener whose callback `NotifyExpired` is running, on the notifying thread's stack
+    struct Firing {
+        ExpiryListener* listener;  // Null once unregistered by its own callback
+        std::thread::id thread;
+    };
+
+    void Unlink(ExpiryListener* listener);
+    void NotifyExpired();
+
+    typename Counts::StrongCount strong_;
+    typename Counts::WeakCount weak_;
+    typename Counts::Lock listeners_lock_;
+    // Read without the lock only to skip it when nobody listens
+    std::atomic<ExpiryListener*> listeners_;
+    Firing* firing_;  // Guarded by `listeners_lock_`
+#ifdef SMART_PTR_HEAP_PROFILE
+    // Sample of the block's allocation, dropped with the block
+    HeapSampleSlot heap_sample_;
+#endif
 };
+template <typename Counts>
+bool BasicControlBlock<Counts>::AddExpiryListener(ExpiryListener* listener) {
+    // Holding a strong reference while linking keeps the last release, and with it
+    // `NotifyExpired`, from running concurrently
+    if (!TryIncreaseStrong()) {
+        return false;
+    }
+    listener->Unregister();
+    {
+        std::lock_guard guard(listeners_lock_);
+        ExpiryListener* head = listeners_.load(std::memory_order_relaxed);
+        listener->block_.store(this, std::memory_order_relaxed);
+        listener->prev_ = nullptr;
+        listener->next_ = head;
+        if (head) {
+            head->prev_ = listener;
+        }
+        listeners_.store(listener, std::memory_order_relaxed);
+    }
+    DecreaseStrong();
+    return true;
+}
+template <typename Counts>
+void BasicControlBlock<Counts>::RemoveExpiryListener(ExpiryListener* listener) {
+    while (true) {
+        {
+            std::lock_guard guard(listeners_lock_);
+            if (!firing_ || firing_->listener != listener) {
+                if (listener->block_.load(std::memory_order_relaxed) == this) {
+                    Unlink(listener);
+                }
+                return;
+            }
+            if (firing_->thread == std::this_thread::get_id()) {
+                // From its own callback: the listener may be gone once the callback returns
+                firing_->listener = nullptr;
+                listener->block_.store(nullptr, std::memory_order_relaxed);
+                return;
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+template <typename Counts>
+void BasicControlBlock<Counts>::Unlink(ExpiryListener* listener) {
+    if (listener->prev_) {
+        listener->prev_->next_ = listener->next_;
+    } else {
+        listeners_.store(listener->next_, std::memory_order_relaxed);
+    }
+    if (listener->next_) {
+        listener->next_->prev_ = listener->prev_;
+    }
+    listener->block_.store(nullptr, std::memory_order_release);
+    listener->prev_ = listener->next_ = nullptr;
+}
+template <typename Counts>
+void BasicControlBlock<Counts>::NotifyExpired() {
+    // Callbacks may unregister other listeners, so they are popped one at a time. A listener
+    // keeps pointing at the block while its callback runs, which makes anyone unregistering it
+    // from another thread wait for the callback instead of freeing it under its feet.
+    Firing firing{nullptr, std::this_thread::get_id()};
+    while (listeners_.load(std::memory_order_relaxed)) {
+        ExpiryListener::Callback callback;
+        void* context;
+        {
+            std::lock_guard guard(listeners_lock_);
+            ExpiryListener* listener = listeners_.load(std::memory_order_relaxed);
+            if (!listener) {
+                return;
+            }
+            Unlink(listener);
+            listener->block_.store(this, std::memory_order_relaxed);
+            callback = listener->callback_;
+            context = listener->context_;
+            firing.listener = listener;
+            firing_ = &firing;
+        }
+        callback(context);
+        std::lock_guard guard(listeners_lock_);
+        if (firing.listener) {
+            // Releases the callback's effects to an `Unregister` that finds the listener idle
+            firing.listener->block_.store(nullptr, std::memory_order_release);
+        }
+        firing_ = nullptr;
+    }
+}
 
-template <typename T>
-class ControlBlockPointer : public ControlBlockBase {
+// The block type of the default `SharedPtr<T>`
+using ControlBlockBase = BasicControlBlock<AtomicCounts>;
+
+inline ExpiryListener::ExpiryListener(Callback callback, void* context)
+    : callback_(callback), context_(context), block_(nullptr), prev_(nullptr), next_(nullptr) {
+}
+inline ExpiryListener::~ExpiryListener() {
+    Unregister();
+}
+inline void ExpiryListener::Unregister() {
+    if (ControlBlockRoot* block = block_.load(std::memory_order_acquire)) {
+        block->RemoveExpiryListener(this);
+    }
+}
+inline bool ExpiryListener::IsRegistered() const {
+    return block_.load(std::memory_order_relaxed) != nullptr;
+}
+
+template <typename T, typename Counts = AtomicCounts, typename Allocation = HeapAllocation>
+class ControlBlockPointer : public BasicControlBlock<Counts>, public AllocatedBy<Allocation> {
 public:
-    explicit ControlBlockPointer(T* ptr) : ControlBlockBase(), ptr_(ptr) {
+    explicit ControlBlockPointer(T* ptr) : BasicControlBlock<Counts>(), ptr_(ptr) {
+        if (ptr_) {
+            SMART_PTR_TRACE_CREATE(ptr_);
+        }
     }
     ~ControlBlockPointer() override {
         if (ptr_) {
@@ -67,21 +272,29 @@ public:
         if (ptr_) {
             T* to_delete = ptr_;
             ptr_ = nullptr;
+            SMART_PTR_TRACE_DESTROY(to_delete);
             delete to_delete;
         }
     }
+    const void* Source() const override {
+        return ptr_;
+    }
+    const std::type_info* SourceType() const override {
+        return &typeid(T);
+    }
 
 private:
     T* ptr_;
 };
 
-template <typename T>
-class ControlBlockEmplace : public ControlBlockBase {
+template <typename T, typename Counts = AtomicCounts, typename Allocation = HeapAllocation>
+class ControlBlockEmplace : public BasicControlBlock<Counts>, public AllocatedBy<Allocation> {
 public:
     template <typename... Args>
-    explicit ControlBlockEmplace(Args&&... args) : ControlBlockBase() {
+    explicit ControlBlockEmplace(Args&&... args) : BasicControlBlock<Counts>() {
         new (&storage_) T{std::forward<Args>(args)...};
         alive_ = true;
+        SMART_PTR_TRACE_CREATE(GetPtr());
     }
     T* GetPtr() {
         return reinterpret_cast<T*>(&storage_);
@@ -95,21 +308,88 @@ public:
     void DeleteSource() override {
         if (alive_) {
             alive_ = false;
+            SMART_PTR_TRACE_DESTROY(GetPtr());
             GetPtr()->~T();
         }
     }
+    const void* Source() const override {
+        return alive_ ? &storage_ : nullptr;
+    }
+    const std::type_info* SourceType() const override {
+        return &typeid(T);
+    }
 
 private:
     std::aligned_storage_t<sizeof(T), alignof(T)> storage_;
     bool alive_;
 };
 
+// One AVX-512 register, and one cache line on the usual hardware
+inline constexpr size_t kSimdAlignment = 64;
+
+// `ControlBlockEmplace` with the payload aligned to `Alignment` rather than `alignof(T)`. The
+// class inherits that alignment, so `new` picks the aligned allocation functions and the
+// virtual destructor the matching deallocation.
+template <typename T, size_t Alignment, typename Counts = AtomicCounts,
+          typename Allocation = HeapAllocation>
+class ControlBlockEmplaceAligned : public BasicControlBlock<Counts>,
+                                   public AllocatedBy<Allocation> {
+public:
+    static_assert(Alignment >= alignof(T) && (Alignment & (Alignment - 1)) == 0);
+
+    template <typename... Args>
+    explicit ControlBlockEmplaceAligned(Args&&... args) : BasicControlBlock<Counts>() {
+        new (&storage_) T{std::forward<Args>(args)...};
+        alive_ = true;
+        SMART_PTR_TRACE_CREATE(GetPtr());
+    }
+    T* GetPtr() {
+        return reinterpret_cast<T*>(&storage_);
+    }
+    ~ControlBlockEmplaceAligned() override {
+        if (alive_) {
+            alive_ = false;
+            GetPtr()->~T();
+        }
+    }
+    void DeleteSource() override {
+        if (alive_) {
+            alive_ = false;
+            SMART_PTR_TRACE_DESTROY(GetPtr());
+            GetPtr()->~T();
+        }
+    }
+    const void* Source() const override {
+        return alive_ ? &storage_ : nullptr;
+    }
+    const std::type_info* SourceType() const override {
+        return &typeid(T);
+    }
+
+private:
+    bool alive_;
+    std::aligned_storage_t<sizeof(T), Alignment> storage_;
+};
+
+// Opt-in for types whose hot fields are read by many threads while others copy and drop
+// pointers to them: specialize to `std::true_type` and `MakeShared<T>` lays the block out as
+// `MakeSharedPadded<T>` does, keeping the counters off the object's cache lines.
+template <typename T>
+struct PadSharedCounters : std::false_type {};
+
+// The block is aligned to a cache line and its base (vptr and counters) sits at offset zero, so
+// a payload aligned to a cache line can only start on a later one; the block size is rounded up
+// to the alignment too, so nothing else is allocated onto the payload's last line either.
+template <typename T>
+inline constexpr size_t kPaddedAlignment = alignof(T) > kSimdAlignment ? alignof(T)
+                                                                       : kSimdAlignment;
+
 ////////////////////////////////////////////////////////////
 
 class BadWeakPtr : public std::exception {};
 
-template <typename T>
+template <typename T, typename Counts = AtomicCounts, typename Allocation = HeapAllocation>
 class SharedPtr;
 
-template <typename T>
+template <typename T, typename Counts = AtomicCounts, typename Allocation = HeapAllocation>
 class WeakPtr;
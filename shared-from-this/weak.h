@@ -2,14 +2,21 @@
 
 #include "sw_fwd.h"  // Forward declaration
 
+#include <utility>
+
 // https://en.cppreference.com/w/cpp/memory/weak_ptr
-template <typename T>
+template <typename T, typename Counts, typename Allocation>
 class WeakPtr {
 public:
-    template <typename Y>
+    template <typename Y, typename C, typename A>
     friend class SharedPtr;
-    template <typename Y>
+    template <typename Y, typename C, typename A>
     friend class WeakPtr;
+    friend class OutputArchive;
+    template <typename U, typename Y, typename C, typename A, typename Cast>
+    friend WeakPtr<U, C, A> WeakPointerCast(const WeakPtr<Y, C, A>& ptr, Cast cast);
+    template <typename U, typename Y, typename C, typename A, typename Cast>
+    friend WeakPtr<U, C, A> WeakPointerCast(WeakPtr<Y, C, A>&& ptr, Cast cast);
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Constructors
 
@@ -19,13 +26,13 @@ public:
     WeakPtr(WeakPtr&& other);
 
     template <typename Y>
-    WeakPtr(const WeakPtr<Y>& other);
+    WeakPtr(const WeakPtr<Y, Counts, Allocation>& other);
 
     template <typename Y>
-    WeakPtr(WeakPtr<Y>&& other);
+    WeakPtr(WeakPtr<Y, Counts, Allocation>&& other);
 
     template <typename Y>
-    WeakPtr(const SharedPtr<Y>& other);
+    WeakPtr(const SharedPtr<Y, Counts, Allocation>& other);
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // `operator=`-s  // TODO: probably operator-s with <Y>
@@ -49,72 +56,84 @@ public:
 
     size_t UseCount() const;
     bool Expired() const;
-    SharedPtr<T> Lock() const;
+    SharedPtr<T, Counts, Allocation> Lock() const;
+
+    // Runs `listener` once the object dies; `false` if it is already gone
+    bool OnExpire(ExpiryListener& listener) const;
+
+    // Identifies the control block: the same for every pointer sharing ownership of an object,
+    // aliased or expired ones included, and `nullptr` for empty pointers
+    const void* OwnerId() const;
 
 private:
     void ControlIncreaseWeak();
     void ControlDecreaseWeak();
     int ControlGetCntStrong() const;
     void Clear();
-    ControlBlockBase* control_;
+    BasicControlBlock<Counts>* control_;
     T* ptr_;
 };
-template <typename T>
-void WeakPtr<T>::Clear() {
+template <typename T, typename Counts, typename Allocation>
+void WeakPtr<T, Counts, Allocation>::Clear() {
     ControlDecreaseWeak();
     control_ = nullptr;
     ptr_ = nullptr;
 }
-template <typename T>
-WeakPtr<T>::~WeakPtr() {
+template <typename T, typename Counts, typename Allocation>
+WeakPtr<T, Counts, Allocation>::~WeakPtr() {
     Clear();
 }
-template <typename T>
-void WeakPtr<T>::ControlIncreaseWeak() {
+template <typename T, typename Counts, typename Allocation>
+void WeakPtr<T, Counts, Allocation>::ControlIncreaseWeak() {
     if (control_) {
         control_->IncreaseWeak();
     }
 }
-template <typename T>
-void WeakPtr<T>::ControlDecreaseWeak() {
+template <typename T, typename Counts, typename Allocation>
+void WeakPtr<T, Counts, Allocation>::ControlDecreaseWeak() {
     if (control_) {
         control_->DecreaseWeak();
     }
 }
-template <typename T>
-int WeakPtr<T>::ControlGetCntStrong() const {
+template <typename T, typename Counts, typename Allocation>
+int WeakPtr<T, Counts, Allocation>::ControlGetCntStrong() const {
     return (control_ ? control_->GetCntStrong() : 0);
 }
-template <typename T>
-WeakPtr<T>::WeakPtr() : control_(nullptr), ptr_(nullptr) {
+template <typename T, typename Counts, typename Allocation>
+WeakPtr<T, Counts, Allocation>::WeakPtr() : control_(nullptr), ptr_(nullptr) {
 }
-template <typename T>
-WeakPtr<T>::WeakPtr(const WeakPtr& other) : control_(other.control_), ptr_(other.ptr_) {
+template <typename T, typename Counts, typename Allocation>
+WeakPtr<T, Counts, Allocation>::WeakPtr(const WeakPtr& other)
+    : control_(other.control_), ptr_(other.ptr_) {
     ControlIncreaseWeak();
 }
-template <typename T>
-WeakPtr<T>::WeakPtr(WeakPtr&& other) : control_(other.control_), ptr_(other.ptr_) {
+template <typename T, typename Counts, typename Allocation>
+WeakPtr<T, Counts, Allocation>::WeakPtr(WeakPtr&& other)
+    : control_(other.control_), ptr_(other.ptr_) {
     other.control_ = nullptr;
     other.ptr_ = nullptr;
 }
-template <typename T>
+template <typename T, typename Counts, typename Allocation>
 template <typename Y>
-WeakPtr<T>::WeakPtr(const WeakPtr<Y>& other) : control_(other.control_), ptr_(other.ptr_) {
+WeakPtr<T, Counts, Allocation>::WeakPtr(const WeakPtr<Y, Counts, Allocation>& other)
+    : control_(other.control_), ptr_(other.ptr_) {
     ControlIncreaseWeak();
 }
-template <typename T>
+template <typename T, typename Counts, typename Allocation>
 template <typename Y>
-WeakPtr<T>::WeakPtr(WeakPtr<Y>&& other) : control_(other.control_), ptr_(other.ptr_) {
+WeakPtr<T, Counts, Allocation>::WeakPtr(WeakPtr<Y, Counts, Allocation>&& other)
+    : control_(other.control_), ptr_(other.ptr_) {
     other.control_ = nullptr;
     other.ptr_ = nullptr;
 }
-template <typename T>
+template <typename T, typename Counts, typename Allocation>
 template <typename Y>
-WeakPtr<T>::WeakPtr(const SharedPtr<Y>& other) : control_(other.control_), ptr_(other.ptr_) {
+WeakPtr<T, Counts, Allocation>::WeakPtr(const SharedPtr<Y, Counts, Allocation>& other)
+    : control_(other.control_), ptr_(other.ptr_) {
     ControlIncreaseWeak();
 }
-template <typename T>
-WeakPtr<T>& WeakPtr<T>::operator=(const WeakPtr& other) {
+template <typename T, typename Counts, typename Allocation>
+WeakPtr<T, Counts, Allocation>& WeakPtr<T, Counts, Allocation>::operator=(const WeakPtr& other) {
     if (&other == this) {
         return *this;
     }
@@ -124,8 +143,8 @@ WeakPtr<T>& WeakPtr<T>::operator=(const WeakPtr& other) {
     ControlIncreaseWeak();
     return *this;
 }
-template <typename T>
-WeakPtr<T>& WeakPtr<T>::operator=(WeakPtr&& other) {
+template <typename T, typename Counts, typename Allocation>
+WeakPtr<T, Counts, Allocation>& WeakPtr<T, Counts, Allocation>::operator=(WeakPtr&& other) {
     if (&other == this) {
         return *this;
     }
@@ -136,29 +155,91 @@ WeakPtr<T>& WeakPtr<T>::operator=(WeakPtr&& other) {
     other.ptr_ = nullptr;
     return *this;
 }
-template <typename T>
-void WeakPtr<T>::Reset() {
+template <typename T, typename Counts, typename Allocation>
+void WeakPtr<T, Counts, Allocation>::Reset() {
     Clear();
 }
-template <typename T>
-void WeakPtr<T>::Swap(WeakPtr& other) {
-    WeakPtr<T> tmp = std::move(*this);
+template <typename T, typename Counts, typename Allocation>
+void WeakPtr<T, Counts, Allocation>::Swap(WeakPtr& other) {
+    WeakPtr tmp = std::move(*this);
     *this = std::move(other);
     other = std::move(tmp);
 }
-template <typename T>
-size_t WeakPtr<T>::UseCount() const {
+template <typename T, typename Counts, typename Allocation>
+size_t WeakPtr<T, Counts, Allocation>::UseCount() const {
     return ControlGetCntStrong();
 }
-template <typename T>
-bool WeakPtr<T>::Expired() const {
+template <typename T, typename Counts, typename Allocation>
+bool WeakPtr<T, Counts, Allocation>::Expired() const {
     return ControlGetCntStrong() == 0;
 }
-template <typename T>
-SharedPtr<T> WeakPtr<T>::Lock() const {
-    if (control_ && control_->IsResourceAlive()) {
-        control_->IncreaseStrong();
-        return SharedPtr(ptr_, control_);
+template <typename T, typename Counts, typename Allocation>
+bool WeakPtr<T, Counts, Allocation>::OnExpire(ExpiryListener& listener) const {
+    return control_ && control_->AddExpiryListener(&listener);
+}
+template <typename T, typename Counts, typename Allocation>
+const void* WeakPtr<T, Counts, Allocation>::OwnerId() const {
+    return control_;
+}
+template <typename T, typename Counts, typename Allocation>
+SharedPtr<T, Counts, Allocation> WeakPtr<T, Counts, Allocation>::Lock() const {
+    if (control_ && control_->TryIncreaseStrong()) {
+        return SharedPtr<T, Counts, Allocation>(ptr_, control_);
+    }
+    return SharedPtr<T, Counts, Allocation>(nullptr, nullptr);
+}
+
+// A `WeakPtr` to the same block storing `cast(stored pointer)`, the weak counterpart of the
+// aliasing constructor; the rvalue overload takes `ptr`'s weak reference over. `cast` must not
+// look at the object, which may be gone.
+template <typename T, typename Y, typename C, typename A, typename Cast>
+WeakPtr<T, C, A> WeakPointerCast(const WeakPtr<Y, C, A>& ptr, Cast cast) {
+    WeakPtr<T, C, A> result;
+    result.control_ = ptr.control_;
+    result.ptr_ = cast(ptr.ptr_);
+    result.ControlIncreaseWeak();
+    return result;
+}
+template <typename T, typename Y, typename C, typename A, typename Cast>
+WeakPtr<T, C, A> WeakPointerCast(WeakPtr<Y, C, A>&& ptr, Cast cast) {
+    WeakPtr<T, C, A> result;
+    result.control_ = std::exchange(ptr.control_, nullptr);
+    result.ptr_ = cast(std::exchange(ptr.ptr_, nullptr));
+    return result;
+}
+
+template <typename T, typename Y, typename C, typename A>
+WeakPtr<T, C, A> StaticPointerCast(const WeakPtr<Y, C, A>& ptr) {
+    return WeakPointerCast<T>(ptr, [](Y* p) { return static_cast<T*>(p); });
+}
+template <typename T, typename Y, typename C, typename A>
+WeakPtr<T, C, A> StaticPointerCast(WeakPtr<Y, C, A>&& ptr) {
+    return WeakPointerCast<T>(std::move(ptr), [](Y* p) { return static_cast<T*>(p); });
+}
+// The dynamic type is only known while the object lives, so expired pointers cast to empty ones
+template <typename T, typename Y, typename C, typename A>
+WeakPtr<T, C, A> DynamicPointerCast(const WeakPtr<Y, C, A>& ptr) {
+    SharedPtr<Y, C, A> locked = ptr.Lock();
+    T* cast = dynamic_cast<T*>(locked.Get());
+    if (!cast) {
+        return WeakPtr<T, C, A>();
+    }
+    return WeakPointerCast<T>(ptr, [cast](Y*) { return cast; });
+}
+template <typename T, typename Y, typename C, typename A>
+WeakPtr<T, C, A> DynamicPointerCast(WeakPtr<Y, C, A>&& ptr) {
+    SharedPtr<Y, C, A> locked = ptr.Lock();
+    T* cast = dynamic_cast<T*>(locked.Get());
+    if (!cast) {
+        return WeakPtr<T, C, A>();
     }
-    return SharedPtr<T>(nullptr, nullptr);
+    return WeakPointerCast<T>(std::move(ptr), [cast](Y*) { return cast; });
+}
+template <typename T, typename Y, typename C, typename A>
+WeakPtr<T, C, A> ConstPointerCast(const WeakPtr<Y, C, A>& ptr) {
+    return WeakPointerCast<T>(ptr, [](Y* p) { return const_cast<T*>(p); });
+}
+template <typename T, typename Y, typename C, typename A>
+WeakPtr<T, C, A> ConstPointerCast(WeakPtr<Y, C, A>&& ptr) {
+    return WeakPointerCast<T>(std::move(ptr), [](Y* p) { return const_cast<T*>(p); });
 }
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>  // std::nullptr_t, std::ptrdiff_t
+#include <cstdint>  // std::intptr_t
+#include <type_traits>
+
+// Self-relative pointer: stores the distance from its own address to the pointee, so it stays
+// valid when the memory containing both is mapped at different addresses in different processes.
+template <typename T>
+class OffsetPtr {
+public:
+    template <typename Y>
+    friend class OffsetPtr;
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    OffsetPtr();
+    OffsetPtr(std::nullptr_t);
+    OffsetPtr(T* ptr);
+
+    OffsetPtr(const OffsetPtr& other);
+
+    template <typename Y>
+    OffsetPtr(const OffsetPtr<Y>& other);
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    OffsetPtr& operator=(const OffsetPtr& other);
+    OffsetPtr& operator=(T* ptr);
+    OffsetPtr& operator=(std::nullptr_t);
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T* Get() const;
+    std::add_lvalue_reference_t<T> operator*() const;
+    T* operator->() const;
+    explicit operator bool() const;
+
+private:
+    // Offset 1 would point into the `OffsetPtr` itself, so it can never address a real pointee
+    static constexpr std::ptrdiff_t kNullOffset = 1;
+
+    void Set(T* ptr);
+
+    std::ptrdiff_t offset_;
+};
+template <typename T>
+OffsetPtr<T>::OffsetPtr() : offset_(kNullOffset) {
+}
+template <typename T>
+OffsetPtr<T>::OffsetPtr(std::nullptr_t) : offset_(kNullOffset) {
+}
+template <typename T>
+OffsetPtr<T>::OffsetPtr(T* ptr) {
+    Set(ptr);
+}
+template <typename T>
+OffsetPtr<T>::OffsetPtr(const OffsetPtr& other) {
+    Set(other.Get());
+}
+template <typename T>
+template <typename Y>
+OffsetPtr<T>::OffsetPtr(const OffsetPtr<Y>& other) {
+    Set(other.Get());
+}
+template <typename T>
+OffsetPtr<T>& OffsetPtr<T>::operator=(const OffsetPtr& other) {
+    Set(other.Get());
+    return *this;
+}
+template <typename T>
+OffsetPtr<T>& OffsetPtr<T>::operator=(T* ptr) {
+    Set(ptr);
+    return *this;
+}
+template <typename T>
+OffsetPtr<T>& OffsetPtr<T>::operator=(std::nullptr_t) {
+    offset_ = kNullOffset;
+    return *this;
+}
+template <typename T>
+void OffsetPtr<T>::Set(T* ptr) {
+    if (ptr == nullptr) {
+        offset_ = kNullOffset;
+        return;
+    }
+    offset_ = reinterpret_cast<std::intptr_t>(ptr) - reinterpret_cast<std::intptr_t>(this);
+}
+template <typename T>
+T* OffsetPtr<T>::Get() const {
+    if (offset_ == kNullOffset) {
+        return nullptr;
+    }
+    return reinterpret_cast<T*>(reinterpret_cast<std::intptr_t>(this) + offset_);
+}
+template <typename T>
+std::add_lvalue_reference_t<T> OffsetPtr<T>::operator*() const {
+    return *Get();
+}
+template <typename T>
+T* OffsetPtr<T>::operator->() const {
+    return Get();
+}
+template <typename T>
+OffsetPtr<T>::operator bool() const {
+    return offset_ != kNullOffset;
+}
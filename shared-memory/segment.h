@@ -0,0 +1,312 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <new>  // std::bad_alloc
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>  // std::exchange
+
+#include <fcntl.h>     // O_* constants
+#include <sys/mman.h>  // mmap, shm_open, memfd_create
+#include <sys/stat.h>  // fstat
+#include <unistd.h>    // ftruncate, close
+
+inline constexpr uint64_t kSegmentMagic = 0x53484d5345474d31;  // "SHMSEGM1"
+inline constexpr size_t kSegmentMaxAlign = 64;
+inline constexpr size_t kSegmentMinBlock = 16;
+inline constexpr size_t kSegmentSizeClasses = 48;
+inline constexpr size_t kSegmentRootSlots = 16;
+
+// Published root of a segment: what another process attaches to first
+struct SegmentRoot {
+    uint64_t control;  // Offset of the control block from the segment base, 0 if empty
+    uint64_t object;   // Offset of the pointee from the segment base
+    uint64_t type_tag;
+};
+
+// Lives at offset 0 of the segment. Everything in it is position-independent, so any process
+// mapping the segment can allocate and free through it.
+class SegmentHeader {
+public:
+    // Throws `std::invalid_argument` if `size` is below `kSegmentMinSize`
+    void Init(size_t size);
+    bool IsValid() const;
+
+    // Blocks are power-of-two sized, so `Deallocate` must be given the size passed to `Allocate`
+    void* Allocate(size_t size, size_t align);
+    void Deallocate(void* ptr, size_t size);
+
+    size_t Size() const;
+    char* Base();
+    uint64_t ToOffset(const void* ptr);
+    void* FromOffset(uint64_t offset);
+
+    void Lock();
+    void Unlock();
+    // Throws `std::out_of_range` unless `slot < kSegmentRootSlots`
+    SegmentRoot& Root(size_t slot);
+
+private:
+    static size_t SizeClass(size_t size);
+
+    uint64_t magic_;
+    uint64_t size_;
+    std::atomic<uint32_t> lock_;
+    uint64_t top_;
+    uint64_t free_lists_[kSegmentSizeClasses];
+    SegmentRoot roots_[kSegmentRootSlots];
+};
+static_assert(std::atomic<uint32_t>::is_always_lock_free,
+              "Segment lock must be address-free to work across processes");
+
+// Allocations start at the first maximally aligned offset past the header
+inline constexpr size_t kSegmentHeaderSize =
+    (sizeof(SegmentHeader) + kSegmentMaxAlign - 1) & ~(kSegmentMaxAlign - 1);
+// Room for the header and one block of the smallest class
+inline constexpr size_t kSegmentMinSize = kSegmentHeaderSize + kSegmentMinBlock;
+
+inline void SegmentHeader::Init(size_t size) {
+    if (size < kSegmentMinSize) {
+        throw std::invalid_argument("segment too small for its header");
+    }
+    magic_ = kSegmentMagic;
+    size_ = size;
+    lock_.store(0, std::memory_order_relaxed);
+    top_ = kSegmentHeaderSize;
+    for (auto& head : free_lists_) {
+        head = 0;
+    }
+    for (auto& root : roots_) {
+        root = SegmentRoot{0, 0, 0};
+    }
+}
+inline bool SegmentHeader::IsValid() const {
+    return magic_ == kSegmentMagic;
+}
+inline size_t SegmentHeader::SizeClass(size_t size) {
+    size_t cls = 0;
+    size_t block = kSegmentMinBlock;
+    while (block < size) {
+        block <<= 1;
+        ++cls;
+    }
+    return cls;
+}
+inline void* SegmentHeader::Allocate(size_t size, size_t align) {
+    if (align > kSegmentMaxAlign) {
+        throw std::bad_alloc();
+    }
+    size_t cls = SizeClass(size < align ? align : size);
+    if (cls >= kSegmentSizeClasses) {
+        throw std::bad_alloc();
+    }
+    size_t block = kSegmentMinBlock << cls;
+    Lock();
+    uint64_t offset = free_lists_[cls];
+    if (offset) {
+        free_lists_[cls] = *static_cast<uint64_t*>(FromOffset(offset));
+    } else {
+        size_t block_align = block < kSegmentMaxAlign ? block : kSegmentMaxAlign;
+        offset = (top_ + block_align - 1) & ~(block_align - 1);
+        if (offset + block > size_) {
+            Unlock();
+            throw std::bad_alloc();
+        }
+        top_ = offset + block;
+    }
+    Unlock();
+    return FromOffset(offset);
+}
+inline void SegmentHeader::Deallocate(void* ptr, size_t size) {
+    if (!ptr) {
+        return;
+    }
+    size_t cls = SizeClass(size);
+    Lock();
+    *static_cast<uint64_t*>(ptr) = free_lists_[cls];
+    free_lists_[cls] = ToOffset(ptr);
+    Unlock();
+}
+inline size_t SegmentHeader::Size() const {
+    return size_;
+}
+inline char* SegmentHeader::Base() {
+    return reinterpret_cast<char*>(this);
+}
+inline uint64_t SegmentHeader::ToOffset(const void* ptr) {
+    return static_cast<const char*>(ptr) - Base();
+}
+inline void* SegmentHeader::FromOffset(uint64_t offset) {
+    return Base() + offset;
+}
+inline void SegmentHeader::Lock() {
+    uint32_t expected = 0;
+    while (!lock_.compare_exchange_weak(expected, 1, std::memory_order_acquire,
+                                        std::memory_order_relaxed)) {
+        expected = 0;
+    }
+}
+inline void SegmentHeader::Unlock() {
+    lock_.store(0, std::memory_order_release);
+}
+inline SegmentRoot& SegmentHeader::Root(size_t slot) {
+    if (slot >= kSegmentRootSlots) {
+        throw std::out_of_range("segment root slot out of range");
+    }
+    return roots_[slot];
+}
+
+// Process-local handle of a mapped segment. Owns the mapping and the file descriptor; the
+// segment itself lives as long as any process keeps it mapped (or, for named ones, until unlink).
+class Segment {
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Factories
+
+    // Anonymous segment backed by memfd; share it by passing `Fd()` to the other process. Both
+    // factories throw `std::invalid_argument` if `size` is below `kSegmentMinSize`.
+    static Segment Create(size_t size);
+    // Named POSIX shared memory object
+    static Segment CreateNamed(const std::string& name, size_t size);
+    static Segment Open(const std::string& name);
+    // Maps an existing segment, taking ownership of `fd`
+    static Segment FromFd(int fd);
+
+    static void Unlink(const std::string& name);
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors, `operator=`-s, destructor
+
+    Segment(Segment&& other);
+    Segment& operator=(Segment&& other);
+    Segment(const Segment& other) = delete;
+    Segment& operator=(const Segment& other) = delete;
+    ~Segment();
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    SegmentHeader* Header() const;
+    int Fd() const;
+    size_t Size() const;
+
+private:
+    Segment(int fd, size_t size, bool init);
+    void Clear();
+
+    int fd_;
+    size_t size_;
+    SegmentHeader* header_;
+};
+inline Segment::Segment(int fd, size_t size, bool init) : fd_(fd), size_(size), header_(nullptr) {
+    void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        int err = errno;
+        close(fd);
+        throw std::system_error(err, std::generic_category(), "mmap");
+    }
+    header_ = static_cast<SegmentHeader*>(base);
+    if (init) {
+        header_->Init(size);
+    } else if (!header_->IsValid()) {
+        Clear();
+        throw std::system_error(EINVAL, std::generic_category(), "not a shared-memory segment");
+    }
+}
+inline Segment Segment::Create(size_t size) {
+    if (size < kSegmentMinSize) {
+        throw std::invalid_argument("segment too small for its header");
+    }
+    int fd = memfd_create("smart-ptr-segment", MFD_CLOEXEC);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "memfd_create");
+    }
+    if (ftruncate(fd, size) < 0) {
+        int err = errno;
+        close(fd);
+        throw std::system_error(err, std::generic_category(), "ftruncate");
+    }
+    return Segment(fd, size, true);
+}
+inline Segment Segment::CreateNamed(const std::string& name, size_t size) {
+    if (size < kSegmentMinSize) {
+        throw std::invalid_argument("segment too small for its header");
+    }
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "shm_open");
+    }
+    if (ftruncate(fd, size) < 0) {
+        int err = errno;
+        close(fd);
+        shm_unlink(name.c_str());
+        throw std::system_error(err, std::generic_category(), "ftruncate");
+    }
+    return Segment(fd, size, true);
+}
+inline Segment Segment::Open(const std::string& name) {
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "shm_open");
+    }
+    return FromFd(fd);
+}
+inline Segment Segment::FromFd(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int err = errno;
+        close(fd);
+        throw std::system_error(err, std::generic_category(), "fstat");
+    }
+    // Reading the header of a shorter file would fault past its end
+    if (static_cast<size_t>(st.st_size) < kSegmentMinSize) {
+        close(fd);
+        throw std::system_error(EINVAL, std::generic_category(), "not a shared-memory segment");
+    }
+    return Segment(fd, st.st_size, false);
+}
+inline void Segment::Unlink(const std::string& name) {
+    shm_unlink(name.c_str());
+}
+inline Segment::Segment(Segment&& other)
+    : fd_(std::exchange(other.fd_, -1)),
+      size_(std::exchange(other.size_, 0)),
+      header_(std::exchange(other.header_, nullptr)) {
+}
+inline Segment& Segment::operator=(Segment&& other) {
+    if (&other == this) {
+        return *this;
+    }
+    Clear();
+    fd_ = std::exchange(other.fd_, -1);
+    size_ = std::exchange(other.size_, 0);
+    header_ = std::exchange(other.header_, nullptr);
+    return *this;
+}
+inline Segment::~Segment() {
+    Clear();
+}
+inline void Segment::Clear() {
+    if (header_) {
+        munmap(header_, size_);
+        header_ = nullptr;
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+    size_ = 0;
+}
+inline SegmentHeader* Segment::Header() const {
+    return header_;
+}
+inline int Segment::Fd() const {
+    return fd_;
+}
+inline size_t Segment::Size() const {
+    return size_;
+}
@@ -0,0 +1,273 @@
+#pragma once
+
+#include "sw_fwd.h"  // Forward declaration
+
+#include <algorithm>  // std::max
+#include <cstddef>    // std::nullptr_t
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// `SharedPtr` whose control block and payload live in a `Segment`. Both members are offsets, so
+// an `ShmSharedPtr` stored inside the segment is valid in every process that maps it.
+// The payload must itself be position-independent: no raw pointers, no virtual functions.
+template <typename T>
+class ShmSharedPtr {
+public:
+    template <typename Y>
+    friend class ShmSharedPtr;
+    template <typename Y>
+    friend class ShmWeakPtr;
+    template <typename Y>
+    friend void ShmPublish(Segment& segment, size_t slot, const ShmSharedPtr<Y>& ptr);
+    template <typename Y>
+    friend ShmSharedPtr<Y> ShmAttach(Segment& segment, size_t slot);
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    ShmSharedPtr();
+    ShmSharedPtr(std::nullptr_t);
+
+    ShmSharedPtr(const ShmSharedPtr& other);
+    ShmSharedPtr(ShmSharedPtr&& other);
+
+    // Aliasing constructor
+    // #8 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
+    template <typename Y>
+    ShmSharedPtr(const ShmSharedPtr<Y>& other, T* ptr);
+
+    template <typename Y>
+    ShmSharedPtr(const ShmSharedPtr<Y>& other);
+
+    template <typename Y>
+    ShmSharedPtr(ShmSharedPtr<Y>&& other);
+
+    ShmSharedPtr(T* ptr, ShmControlBlock* block);
+
+    // Promote `ShmWeakPtr`
+    explicit ShmSharedPtr(const ShmWeakPtr<T>& other);
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    ShmSharedPtr& operator=(const ShmSharedPtr& other);
+    ShmSharedPtr& operator=(ShmSharedPtr&& other);
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~ShmSharedPtr();
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset();
+    void Swap(ShmSharedPtr& other);
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T* Get() const;
+    T& operator*() const;
+    T* operator->() const;
+    size_t UseCount() const;
+    explicit operator bool() const;
+
+private:
+    void ControlIncreaseStrong();
+    void ControlDecreaseStrong();
+    void Clear();
+    OffsetPtr<ShmControlBlock> control_;
+    OffsetPtr<T> ptr_;
+};
+template <typename T>
+ShmSharedPtr<T>::ShmSharedPtr() : control_(nullptr), ptr_(nullptr) {
+}
+template <typename T>
+ShmSharedPtr<T>::ShmSharedPtr(std::nullptr_t) : control_(nullptr), ptr_(nullptr) {
+}
+template <typename T>
+ShmSharedPtr<T>::ShmSharedPtr(const ShmSharedPtr& other)
+    : control_(other.control_), ptr_(other.ptr_) {
+    ControlIncreaseStrong();
+}
+template <typename T>
+ShmSharedPtr<T>::ShmSharedPtr(ShmSharedPtr&& other) : control_(other.control_), ptr_(other.ptr_) {
+    other.control_ = nullptr;
+    other.ptr_ = nullptr;
+}
+template <typename T>
+template <typename Y>
+ShmSharedPtr<T>::ShmSharedPtr(const ShmSharedPtr<Y>& other, T* ptr)
+    : control_(other.control_), ptr_(ptr) {
+    ControlIncreaseStrong();
+}
+template <typename T>
+template <typename Y>
+ShmSharedPtr<T>::ShmSharedPtr(const ShmSharedPtr<Y>& other)
+    : control_(other.control_), ptr_(other.ptr_.Get()) {
+    ControlIncreaseStrong();
+}
+template <typename T>
+template <typename Y>
+ShmSharedPtr<T>::ShmSharedPtr(ShmSharedPtr<Y>&& other)
+    : control_(other.control_), ptr_(other.ptr_.Get()) {
+    other.control_ = nullptr;
+    other.ptr_ = nullptr;
+}
+template <typename T>
+ShmSharedPtr<T>::ShmSharedPtr(T* ptr, ShmControlBlock* block) : control_(block), ptr_(ptr) {
+}
+template <typename T>
+ShmSharedPtr<T>::ShmSharedPtr(const ShmWeakPtr<T>& other) : control_(nullptr), ptr_(nullptr) {
+    if (!other.control_ || !other.control_->TryIncreaseStrong()) {
+        throw BadShmWeakPtr();
+    }
+    control_ = other.control_;
+    ptr_ = other.ptr_;
+}
+template <typename T>
+void ShmSharedPtr<T>::Clear() {
+    ControlDecreaseStrong();
+    control_ = nullptr;
+    ptr_ = nullptr;
+}
+template <typename T>
+ShmSharedPtr<T>& ShmSharedPtr<T>::operator=(const ShmSharedPtr& other) {
+    if (&other == this) {
+        return *this;
+    }
+    Clear();
+    control_ = other.control_;
+    ptr_ = other.ptr_;
+    ControlIncreaseStrong();
+    return *this;
+}
+template <typename T>
+ShmSharedPtr<T>& ShmSharedPtr<T>::operator=(ShmSharedPtr&& other) {
+    if (&other == this) {
+        return *this;
+    }
+    Clear();
+    control_ = other.control_;
+    ptr_ = other.ptr_;
+    other.control_ = nullptr;
+    other.ptr_ = nullptr;
+    return *this;
+}
+template <typename T>
+ShmSharedPtr<T>::~ShmSharedPtr() {
+    Clear();
+}
+template <typename T>
+void ShmSharedPtr<T>::Reset() {
+    Clear();
+}
+template <typename T>
+void ShmSharedPtr<T>::Swap(ShmSharedPtr& other) {
+    ShmSharedPtr tmp = std::move(*this);
+    *this = std::move(other);
+    other = std::move(tmp);
+}
+template <typename T>
+T* ShmSharedPtr<T>::Get() const {
+    return ptr_.Get();
+}
+template <typename T>
+T& ShmSharedPtr<T>::operator*() const {
+    return *ptr_;
+}
+template <typename T>
+T* ShmSharedPtr<T>::operator->() const {
+    return ptr_.Get();
+}
+template <typename T>
+size_t ShmSharedPtr<T>::UseCount() const {
+    return (control_ ? control_->GetCntStrong() : 0);
+}
+template <typename T>
+ShmSharedPtr<T>::operator bool() const {
+    return static_cast<bool>(control_);
+}
+template <typename T>
+void ShmSharedPtr<T>::ControlIncreaseStrong() {
+    if (control_) {
+        control_->IncreaseStrong();
+    }
+}
+template <typename T>
+void ShmSharedPtr<T>::ControlDecreaseStrong() {
+    if (control_) {
+        control_->DecreaseStrong();
+    }
+}
+
+// Fused control block + payload allocated from the segment, the analogue of `MakeShared`
+template <typename T, typename... Args>
+ShmSharedPtr<T> MakeShmShared(Segment& segment, Args&&... args) {
+    static_assert(!std::is_polymorphic_v<T>, "vtable pointers are process-local");
+    static_cast<void>(ShmType<T>::kRegistered);
+
+    constexpr size_t kObjectOffset =
+        (sizeof(ShmControlBlock) + alignof(T) - 1) / alignof(T) * alignof(T);
+    constexpr size_t kBlockSize = kObjectOffset + sizeof(T);
+    SegmentHeader* header = segment.Header();
+    char* memory = static_cast<char*>(
+        header->Allocate(kBlockSize, std::max(alignof(T), alignof(ShmControlBlock))));
+    T* object;
+    try {
+        object = new (memory + kObjectOffset) T{std::forward<Args>(args)...};
+    } catch (...) {
+        header->Deallocate(memory, kBlockSize);
+        throw;
+    }
+    auto block = new (memory) ShmControlBlock(header, object, ShmDestroyTag<T>(), kBlockSize);
+    return ShmSharedPtr<T>(object, block);
+}
+
+////////////////////////////////////////////////////////////
+
+// Stores a strong reference in one of the segment's root slots, replacing the previous one.
+// This is how a pointer is handed over to another process.
+template <typename T>
+void ShmPublish(Segment& segment, size_t slot, const ShmSharedPtr<T>& ptr) {
+    SegmentHeader* header = segment.Header();
+    // Checks `slot` before anything is taken
+    SegmentRoot& root = header->Root(slot);
+    ShmControlBlock* block = ptr.control_.Get();
+    if (block) {
+        block->IncreaseStrong();
+    }
+    header->Lock();
+    uint64_t old = root.control;
+    root.control = block ? header->ToOffset(block) : 0;
+    root.object = block ? header->ToOffset(ptr.Get()) : 0;
+    root.type_tag = ShmTypeTag<std::remove_cv_t<T>>();
+    header->Unlock();
+    if (old) {
+        static_cast<ShmControlBlock*>(header->FromOffset(old))->DecreaseStrong();
+    }
+}
+
+// Takes a new strong reference to what another process published in `slot`
+template <typename T>
+ShmSharedPtr<T> ShmAttach(Segment& segment, size_t slot) {
+    static_cast<void>(ShmType<std::remove_cv_t<T>>::kRegistered);
+
+    SegmentHeader* header = segment.Header();
+    const SegmentRoot& root = header->Root(slot);
+    header->Lock();
+    if (!root.control) {
+        header->Unlock();
+        return ShmSharedPtr<T>();
+    }
+    if (root.type_tag != ShmTypeTag<std::remove_cv_t<T>>()) {
+        header->Unlock();
+        throw BadShmCast();
+    }
+    auto block = static_cast<ShmControlBlock*>(header->FromOffset(root.control));
+    auto object = static_cast<T*>(header->FromOffset(root.object));
+    block->IncreaseStrong();
+    header->Unlock();
+    return ShmSharedPtr<T>(object, block);
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include "offset_ptr.h"
+#include "segment.h"
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <type_traits>
+#include <typeinfo>
+#include <unordered_map>
+
+////////////////////////////////////////////////////////////
+
+using ShmDestroyer = void (*)(void*);
+
+// Destructors cannot be called through a vtable or a function pointer stored in the segment:
+// both are process-local. Instead the block stores a tag of the payload type and every process
+// resolves it through its own registry, filled for each type it instantiates `ShmSharedPtr` with.
+class ShmTypeRegistry {
+public:
+    static bool Register(uint64_t tag, ShmDestroyer destroyer);
+    static ShmDestroyer Find(uint64_t tag);
+
+private:
+    static std::mutex& Mutex();
+    static std::unordered_map<uint64_t, ShmDestroyer>& Table();
+};
+inline bool ShmTypeRegistry::Register(uint64_t tag, ShmDestroyer destroyer) {
+    std::lock_guard guard(Mutex());
+    Table().emplace(tag, destroyer);
+    return true;
+}
+inline ShmDestroyer ShmTypeRegistry::Find(uint64_t tag) {
+    std::lock_guard guard(Mutex());
+    auto it = Table().find(tag);
+    return it == Table().end() ? nullptr : it->second;
+}
+inline std::mutex& ShmTypeRegistry::Mutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+inline std::unordered_map<uint64_t, ShmDestroyer>& ShmTypeRegistry::Table() {
+    static std::unordered_map<uint64_t, ShmDestroyer> table;
+    return table;
+}
+
+// FNV-1a of the mangled name: identical in every process running the same build
+template <typename T>
+uint64_t ShmTypeTag() {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (const char* c = typeid(T).name(); *c; ++c) {
+        hash = (hash ^ static_cast<unsigned char>(*c)) * 0x100000001b3;
+    }
+    return hash;
+}
+
+// Tag 0 marks trivially destructible payloads, which need no registry lookup at all
+template <typename T>
+uint64_t ShmDestroyTag() {
+    return std::is_trivially_destructible_v<T> ? 0 : ShmTypeTag<T>();
+}
+
+template <typename T>
+struct ShmType {
+    static void Destroy(void* object) {
+        static_cast<T*>(object)->~T();
+    }
+    // Dynamic initialization registers the type at startup in every process that uses it
+    static inline const bool kRegistered =
+        ShmTypeRegistry::Register(ShmDestroyTag<T>(), &Destroy);
+};
+
+////////////////////////////////////////////////////////////
+
+// Non-virtual, position-independent control block placed in the segment.
+// Strong references collectively hold one weak reference, so the last strong release destroys
+// the payload and then decides with a single weak decrement whether to free the block.
+class ShmControlBlock {
+public:
+    ShmControlBlock(SegmentHeader* segment, void* object, uint64_t destroy_tag,
+                    uint64_t block_size);
+
+    void IncreaseStrong();
+    bool TryIncreaseStrong();
+    void DecreaseStrong();
+    uint32_t GetCntStrong() const;
+    void IncreaseWeak();
+    void DecreaseWeak();
+    bool IsResourceAlive() const;
+
+    SegmentHeader* GetSegment() const;
+
+private:
+    void DeleteSource();
+
+    std::atomic<uint32_t> cnt_strong_ref_;
+    std::atomic<uint32_t> cnt_weak_ref_;
+    uint64_t destroy_tag_;
+    uint64_t block_size_;
+    OffsetPtr<SegmentHeader> segment_;
+    OffsetPtr<void> object_;
+};
+static_assert(std::atomic<uint32_t>::is_always_lock_free,
+              "Reference counts must be address-free to work across processes");
+
+inline ShmControlBlock::ShmControlBlock(SegmentHeader* segment, void* object,
+                                        uint64_t destroy_tag, uint64_t block_size)
+    : cnt_strong_ref_(1),
+      cnt_weak_ref_(1),
+      destroy_tag_(destroy_tag),
+      block_size_(block_size),
+      segment_(segment),
+      object_(object) {
+}
+inline void ShmControlBlock::IncreaseStrong() {
+    cnt_strong_ref_.fetch_add(1, std::memory_order_relaxed);
+}
+inline bool ShmControlBlock::TryIncreaseStrong() {
+    uint32_t cnt = cnt_strong_ref_.load(std::memory_order_relaxed);
+    while (cnt != 0) {
+        if (cnt_strong_ref_.compare_exchange_weak(cnt, cnt + 1, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+inline void ShmControlBlock::DecreaseStrong() {
+    if (cnt_strong_ref_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        DeleteSource();
+        DecreaseWeak();
+    }
+}
+inline uint32_t ShmControlBlock::GetCntStrong() const {
+    return cnt_strong_ref_.load(std::memory_order_relaxed);
+}
+inline void ShmControlBlock::IncreaseWeak() {
+    cnt_weak_ref_.fetch_add(1, std::memory_order_relaxed);
+}
+inline void ShmControlBlock::DecreaseWeak() {
+    if (cnt_weak_ref_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        SegmentHeader* segment = segment_.Get();
+        uint64_t block_size = block_size_;
+        this->~ShmControlBlock();
+        segment->Deallocate(this, block_size);
+    }
+}
+inline bool ShmControlBlock::IsResourceAlive() const {
+    return GetCntStrong() != 0;
+}
+inline SegmentHeader* ShmControlBlock::GetSegment() const {
+    return segment_.Get();
+}
+inline void ShmControlBlock::DeleteSource() {
+    if (destroy_tag_ == 0) {
+        return;
+    }
+    ShmDestroyer destroyer = ShmTypeRegistry::Find(destroy_tag_);
+    if (!destroyer) {
+        // The payload type was never instantiated in this process: nothing sane to do
+        std::terminate();
+    }
+    destroyer(object_.Get());
+}
+
+////////////////////////////////////////////////////////////
+
+class BadShmCast : public std::exception {};
+
+class BadShmWeakPtr : public std::exception {};
+
+template <typename T>
+class ShmSharedPtr;
+
+template <typename T>
+class ShmWeakPtr;
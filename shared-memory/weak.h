@@ -0,0 +1,151 @@
+#pragma once
+
+#include "sw_fwd.h"  // Forward declaration
+
+// `WeakPtr` counterpart of `ShmSharedPtr`; may be stored inside the segment as well
+template <typename T>
+class ShmWeakPtr {
+public:
+    template <typename Y>
+    friend class ShmSharedPtr;
+    template <typename Y>
+    friend class ShmWeakPtr;
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    ShmWeakPtr();
+
+    ShmWeakPtr(const ShmWeakPtr& other);
+    ShmWeakPtr(ShmWeakPtr&& other);
+
+    template <typename Y>
+    ShmWeakPtr(const ShmWeakPtr<Y>& other);
+
+    template <typename Y>
+    ShmWeakPtr(const ShmSharedPtr<Y>& other);
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    ShmWeakPtr& operator=(const ShmWeakPtr& other);
+    ShmWeakPtr& operator=(ShmWeakPtr&& other);
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~ShmWeakPtr();
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset();
+    void Swap(ShmWeakPtr& other);
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    size_t UseCount() const;
+    bool Expired() const;
+    ShmSharedPtr<T> Lock() const;
+
+private:
+    void ControlIncreaseWeak();
+    void ControlDecreaseWeak();
+    void Clear();
+    OffsetPtr<ShmControlBlock> control_;
+    OffsetPtr<T> ptr_;
+};
+template <typename T>
+void ShmWeakPtr<T>::Clear() {
+    ControlDecreaseWeak();
+    control_ = nullptr;
+    ptr_ = nullptr;
+}
+template <typename T>
+ShmWeakPtr<T>::~ShmWeakPtr() {
+    Clear();
+}
+template <typename T>
+void ShmWeakPtr<T>::ControlIncreaseWeak() {
+    if (control_) {
+        control_->IncreaseWeak();
+    }
+}
+template <typename T>
+void ShmWeakPtr<T>::ControlDecreaseWeak() {
+    if (control_) {
+        control_->DecreaseWeak();
+    }
+}
+template <typename T>
+ShmWeakPtr<T>::ShmWeakPtr() : control_(nullptr), ptr_(nullptr) {
+}
+template <typename T>
+ShmWeakPtr<T>::ShmWeakPtr(const ShmWeakPtr& other) : control_(other.control_), ptr_(other.ptr_) {
+    ControlIncreaseWeak();
+}
+template <typename T>
+ShmWeakPtr<T>::ShmWeakPtr(ShmWeakPtr&& other) : control_(other.control_), ptr_(other.ptr_) {
+    other.control_ = nullptr;
+    other.ptr_ = nullptr;
+}
+template <typename T>
+template <typename Y>
+ShmWeakPtr<T>::ShmWeakPtr(const ShmWeakPtr<Y>& other)
+    : control_(other.control_), ptr_(other.ptr_.Get()) {
+    ControlIncreaseWeak();
+}
+template <typename T>
+template <typename Y>
+ShmWeakPtr<T>::ShmWeakPtr(const ShmSharedPtr<Y>& other)
+    : control_(other.control_), ptr_(other.ptr_.Get()) {
+    ControlIncreaseWeak();
+}
+template <typename T>
+ShmWeakPtr<T>& ShmWeakPtr<T>::operator=(const ShmWeakPtr& other) {
+    if (&other == this) {
+        return *this;
+    }
+    Clear();
+    control_ = other.control_;
+    ptr_ = other.ptr_;
+    ControlIncreaseWeak();
+    return *this;
+}
+template <typename T>
+ShmWeakPtr<T>& ShmWeakPtr<T>::operator=(ShmWeakPtr&& other) {
+    if (&other == this) {
+        return *this;
+    }
+    Clear();
+    control_ = other.control_;
+    ptr_ = other.ptr_;
+    other.control_ = nullptr;
+    other.ptr_ = nullptr;
+    return *this;
+}
+template <typename T>
+void ShmWeakPtr<T>::Reset() {
+    Clear();
+}
+template <typename T>
+void ShmWeakPtr<T>::Swap(ShmWeakPtr& other) {
+    ShmWeakPtr<T> tmp = std::move(*this);
+    *this = std::move(other);
+    other = std::move(tmp);
+}
+template <typename T>
+size_t ShmWeakPtr<T>::UseCount() const {
+    return (control_ ? control_->GetCntStrong() : 0);
+}
+template <typename T>
+bool ShmWeakPtr<T>::Expired() const {
+    return UseCount() == 0;
+}
+template <typename T>
+ShmSharedPtr<T> ShmWeakPtr<T>::Lock() const {
+    if (control_ && control_->TryIncreaseStrong()) {
+        return ShmSharedPtr<T>(ptr_.Get(), control_.Get());
+    }
+    return ShmSharedPtr<T>(nullptr, nullptr);
+}
@@ -0,0 +1,418 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+inline constexpr uint32_t kSlotMapNone = std::numeric_limits<uint32_t>::max();
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Kernels over dense arrays of counts: eight lanes per step with AVX2, four with SSE2, a plain
+// loop otherwise.
+
+// Appends the positions of the zero counts in `counts[0, size)` to `positions`, in order
+inline void FindZeroSlotCounts(const uint32_t* counts, size_t size,
+                               std::vector<uint32_t>& positions) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i zero = _mm256_setzero_si256();
+    for (; i + 8 <= size; i += 8) {
+        __m256i lanes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(counts + i));
+        auto mask = static_cast<uint32_t>(
+            _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(lanes, zero))));
+        for (; mask; mask &= mask - 1) {
+            positions.push_back(static_cast<uint32_t>(i + __builtin_ctz(mask)));
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 4 <= size; i += 4) {
+        __m128i lanes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(counts + i));
+        auto mask = static_cast<uint32_t>(
+            _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(lanes, zero))));
+        for (; mask; mask &= mask - 1) {
+            positions.push_back(static_cast<uint32_t>(i + __builtin_ctz(mask)));
+        }
+    }
+#endif
+    for (; i < size; ++i) {
+        if (counts[i] == 0) {
+            positions.push_back(static_cast<uint32_t>(i));
+        }
+    }
+}
+
+// `counts[i] += deltas[i]` for `i` in `[0, size)`; no count may end up below zero
+inline void AddSlotCounts(uint32_t* counts, const int32_t* deltas, size_t size) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 8 <= size; i += 8) {
+        auto target = reinterpret_cast<__m256i*>(counts + i);
+        __m256i sum = _mm256_add_epi32(
+            _mm256_loadu_si256(target),
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(deltas + i)));
+        _mm256_storeu_si256(target, sum);
+    }
+#elif defined(__SSE2__)
+    for (; i + 4 <= size; i += 4) {
+        auto target = reinterpret_cast<__m128i*>(counts + i);
+        __m128i sum = _mm_add_epi32(_mm_loadu_si128(target),
+                                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(deltas + i)));
+        _mm_storeu_si128(target, sum);
+    }
+#endif
+    for (; i < size; ++i) {
+        counts[i] += static_cast<uint32_t>(deltas[i]);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Reference to an element of a `SlotMap`: a slot index and the generation the slot had when the
+// element was inserted, packed in 64 bits. Live generations are odd, so the null handle (all
+// zeros) never matches anything.
+class SlotHandle {
+public:
+    template <typename T, bool Counted>
+    friend class SlotMap;
+
+    SlotHandle() : bits_(0) {
+    }
+    static SlotHandle FromBits(uint64_t bits) {
+        SlotHandle handle;
+        handle.bits_ = bits;
+        return handle;
+    }
+
+    uint64_t Bits() const {
+        return bits_;
+    }
+    uint32_t Index() const {
+        return static_cast<uint32_t>(bits_);
+    }
+    uint32_t Generation() const {
+        return static_cast<uint32_t>(bits_ >> 32);
+    }
+    explicit operator bool() const {
+        return bits_ != 0;
+    }
+    bool operator==(const SlotHandle& other) const {
+        return bits_ == other.bits_;
+    }
+    bool operator!=(const SlotHandle& other) const {
+        return bits_ != other.bits_;
+    }
+
+private:
+    SlotHandle(uint32_t index, uint32_t generation)
+        : bits_(static_cast<uint64_t>(generation) << 32 | index) {
+    }
+
+    uint64_t bits_;
+};
+
+// Objects addressed by generational handles, a lighter alternative to `WeakPtr` for large
+// populations of same-typed objects such as game entities: a handle is one word, checking it is
+// one indexed load and compare, and a stale handle simply stops resolving once its element is
+// erased and the slot is reused.
+//
+// Elements are kept packed in insertion order, modulo erasures, which move the last element into
+// the hole; iterating over them is a walk over one array. Pointers to elements are invalidated
+// by any insertion or erasure, handles only by erasing their own element. A slot whose generation
+// would wrap around is retired rather than reused.
+//
+// With `Counted`, each element also has a strong count, in a dense array of its own parallel to
+// the elements: insertion gives it one, `IncRef`/`DecRef` adjust it, and instead of destroying
+// elements one at a time when they reach zero, `SweepDead` erases them all in one SIMD scan.
+// Systems that change many counts at once can apply their changes with `AddCounts`.
+template <typename T, bool Counted = false>
+class SlotMap {
+public:
+    using Handle = SlotHandle;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    Handle Insert(T value);
+    template <typename... Args>
+    Handle Emplace(Args&&... args);
+    // Returns `false` if the handle is stale
+    bool Erase(Handle handle);
+    void Clear();
+    void Reserve(size_t size);
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Lookups
+
+    bool Contains(Handle handle) const;
+    // Null if the handle is stale
+    T* Find(Handle handle);
+    const T* Find(Handle handle) const;
+    // Throw `std::out_of_range` if the handle is stale
+    T& At(Handle handle);
+    const T& At(Handle handle) const;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Dense access
+
+    size_t Size() const;
+    bool Empty() const;
+    T* begin();
+    T* end();
+    const T* begin() const;
+    const T* end() const;
+    // Handle of the element at `position` in iteration order
+    Handle HandleAt(size_t position) const;
+    // Calls `function(handle, element)` for every element
+    template <typename Function>
+    void ForEach(Function&& function);
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Strong counts, with `Counted` only. The per-handle ones throw `std::out_of_range` if the
+    // handle is stale.
+
+    void IncRef(Handle handle);
+    // Returns the count left; an element reaching zero stays until `SweepDead`
+    uint32_t DecRef(Handle handle);
+    uint32_t RefCount(Handle handle) const;
+    // Counts in iteration order
+    const uint32_t* Counts() const;
+    // Adds `deltas[i]` to the count of the element at position `i`, for every element
+    void AddCounts(const int32_t* deltas);
+    // Erases every element with a count of zero, returning how many there were
+    size_t SweepDead();
+
+private:
+    struct Slot {
+        uint32_t generation;  // Odd while the slot holds an element
+        uint32_t position;    // The element's position if live, else the next free slot
+    };
+
+    const Slot* LiveSlot(Handle handle) const;
+    const Slot& CheckedSlot(Handle handle) const;
+    void EraseAt(uint32_t position);
+
+    std::vector<Slot> slots_;
+    std::vector<T> values_;
+    // Slot of each element, and with `Counted` its count, both parallel to `values_`
+    std::vector<uint32_t> owners_;
+    std::vector<uint32_t> counts_;
+    uint32_t free_head_ = kSlotMapNone;
+};
+
+template <typename T, bool Counted>
+typename SlotMap<T, Counted>::Handle SlotMap<T, Counted>::Insert(T value) {
+    return Emplace(std::move(value));
+}
+template <typename T, bool Counted>
+template <typename... Args>
+typename SlotMap<T, Counted>::Handle SlotMap<T, Counted>::Emplace(Args&&... args) {
+    bool reuse = free_head_ != kSlotMapNone;
+    if (!reuse && slots_.size() == kSlotMapNone) {
+        throw std::length_error("SlotMap: out of slots");
+    }
+    uint32_t index = reuse ? free_head_ : static_cast<uint32_t>(slots_.size());
+    auto position = static_cast<uint32_t>(values_.size());
+    // Everything that may throw comes first, so that a failure leaves the map as it was
+    try {
+        if (!reuse) {
+            slots_.push_back({0, kSlotMapNone});
+        }
+        owners_.push_back(index);
+        if constexpr (Counted) {
+            counts_.push_back(1);
+        }
+        values_.emplace_back(std::forward<Args>(args)...);
+    } catch (...) {
+        if (!reuse) {
+            slots_.resize(index);
+        }
+        owners_.resize(position);
+        counts_.resize(Counted ? position : 0);
+        throw;
+    }
+    Slot& slot = slots_[index];
+    if (reuse) {
+        free_head_ = slot.position;
+    }
+    ++slot.generation;
+    slot.position = position;
+    return Handle(index, slot.generation);
+}
+template <typename T, bool Counted>
+bool SlotMap<T, Counted>::Erase(Handle handle) {
+    const Slot* slot = LiveSlot(handle);
+    if (!slot) {
+        return false;
+    }
+    EraseAt(slot->position);
+    return true;
+}
+template <typename T, bool Counted>
+void SlotMap<T, Counted>::EraseAt(uint32_t position) {
+    uint32_t index = owners_[position];
+    auto last = static_cast<uint32_t>(values_.size() - 1);
+    if (position != last) {
+        values_[position] = std::move(values_[last]);
+        owners_[position] = owners_[last];
+        if constexpr (Counted) {
+            counts_[position] = counts_[last];
+        }
+        slots_[owners_[position]].position = position;
+    }
+    values_.pop_back();
+    owners_.pop_back();
+    if constexpr (Counted) {
+        counts_.pop_back();
+    }
+    Slot& slot = slots_[index];
+    // Back to even, or to zero, in which case every generation has been handed out
+    if (++slot.generation != 0) {
+        slot.position = free_head_;
+        free_head_ = index;
+    }
+}
+template <typename T, bool Counted>
+void SlotMap<T, Counted>::Clear() {
+    for (uint32_t index : owners_) {
+        Slot& slot = slots_[index];
+        if (++slot.generation != 0) {
+            slot.position = free_head_;
+            free_head_ = index;
+        }
+    }
+    values_.clear();
+    owners_.clear();
+    counts_.clear();
+}
+template <typename T, bool Counted>
+void SlotMap<T, Counted>::Reserve(size_t size) {
+    slots_.reserve(size);
+    values_.reserve(size);
+    owners_.reserve(size);
+    if constexpr (Counted) {
+        counts_.reserve(size);
+    }
+}
+template <typename T, bool Counted>
+const typename SlotMap<T, Counted>::Slot* SlotMap<T, Counted>::LiveSlot(Handle handle) const {
+    uint32_t index = handle.Index();
+    if (index >= slots_.size() || slots_[index].generation != handle.Generation() ||
+        !(handle.Generation() & 1)) {
+        return nullptr;
+    }
+    return &slots_[index];
+}
+template <typename T, bool Counted>
+const typename SlotMap<T, Counted>::Slot& SlotMap<T, Counted>::CheckedSlot(Handle handle) const {
+    const Slot* slot = LiveSlot(handle);
+    if (!slot) {
+        throw std::out_of_range("SlotMap: stale handle");
+    }
+    return *slot;
+}
+template <typename T, bool Counted>
+bool SlotMap<T, Counted>::Contains(Handle handle) const {
+    return LiveSlot(handle) != nullptr;
+}
+template <typename T, bool Counted>
+T* SlotMap<T, Counted>::Find(Handle handle) {
+    const Slot* slot = LiveSlot(handle);
+    return slot ? &values_[slot->position] : nullptr;
+}
+template <typename T, bool Counted>
+const T* SlotMap<T, Counted>::Find(Handle handle) const {
+    const Slot* slot = LiveSlot(handle);
+    return slot ? &values_[slot->position] : nullptr;
+}
+template <typename T, bool Counted>
+T& SlotMap<T, Counted>::At(Handle handle) {
+    return values_[CheckedSlot(handle).position];
+}
+template <typename T, bool Counted>
+const T& SlotMap<T, Counted>::At(Handle handle) const {
+    return values_[CheckedSlot(handle).position];
+}
+template <typename T, bool Counted>
+size_t SlotMap<T, Counted>::Size() const {
+    return values_.size();
+}
+template <typename T, bool Counted>
+bool SlotMap<T, Counted>::Empty() const {
+    return values_.empty();
+}
+template <typename T, bool Counted>
+T* SlotMap<T, Counted>::begin() {
+    return values_.data();
+}
+template <typename T, bool Counted>
+T* SlotMap<T, Counted>::end() {
+    return values_.data() + values_.size();
+}
+template <typename T, bool Counted>
+const T* SlotMap<T, Counted>::begin() const {
+    return values_.data();
+}
+template <typename T, bool Counted>
+const T* SlotMap<T, Counted>::end() const {
+    return values_.data() + values_.size();
+}
+template <typename T, bool Counted>
+typename SlotMap<T, Counted>::Handle SlotMap<T, Counted>::HandleAt(size_t position) const {
+    uint32_t index = owners_[position];
+    return Handle(index, slots_[index].generation);
+}
+template <typename T, bool Counted>
+template <typename Function>
+void SlotMap<T, Counted>::ForEach(Function&& function) {
+    for (size_t i = 0; i < values_.size(); ++i) {
+        function(HandleAt(i), values_[i]);
+    }
+}
+template <typename T, bool Counted>
+void SlotMap<T, Counted>::IncRef(Handle handle) {
+    static_assert(Counted, "SlotMap: strong counts need `Counted`");
+    ++counts_[CheckedSlot(handle).position];
+}
+template <typename T, bool Counted>
+uint32_t SlotMap<T, Counted>::DecRef(Handle handle) {
+    static_assert(Counted, "SlotMap: strong counts need `Counted`");
+    return --counts_[CheckedSlot(handle).position];
+}
+template <typename T, bool Counted>
+uint32_t SlotMap<T, Counted>::RefCount(Handle handle) const {
+    static_assert(Counted, "SlotMap: strong counts need `Counted`");
+    return counts_[CheckedSlot(handle).position];
+}
+template <typename T, bool Counted>
+const uint32_t* SlotMap<T, Counted>::Counts() const {
+    static_assert(Counted, "SlotMap: strong counts need `Counted`");
+    return counts_.data();
+}
+template <typename T, bool Counted>
+void SlotMap<T, Counted>::AddCounts(const int32_t* deltas) {
+    static_assert(Counted, "SlotMap: strong counts need `Counted`");
+    AddSlotCounts(counts_.data(), deltas, counts_.size());
+}
+template <typename T, bool Counted>
+size_t SlotMap<T, Counted>::SweepDead() {
+    static_assert(Counted, "SlotMap: strong counts need `Counted`");
+    std::vector<uint32_t> dead;
+    FindZeroSlotCounts(counts_.data(), counts_.size(), dead);
+    // Last to first: every element moved into a hole comes from past all the remaining dead
+    // positions, and the dead ones among those are already gone
+    for (size_t i = dead.size(); i > 0; --i) {
+        EraseAt(dead[i - 1]);
+    }
+    return dead.size();
+}
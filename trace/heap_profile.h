@@ -0,0 +1,271 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <execinfo.h>
+
+// Sampling heap profiler by allocation site, compiled into the pointer headers only when
+// `SMART_PTR_HEAP_PROFILE` is defined (see `hooks.h`). It covers `MakeShared` and its variants,
+// `SharedPtr`s adopting raw pointers, and `MakeIntrusive` of `RefCounted` types.
+//
+// As in tcmalloc, allocations are sampled at points of a Poisson process over the bytes each
+// thread allocates: one every `period` bytes on average, so an allocation of `n` bytes is sampled
+// with probability `1 - exp(-n / period)`. A sampled allocation gets a side record with its stack,
+// held by the control block (or the `RefCounted` base) and dropped when that memory is freed;
+// expired objects whose blocks are kept by weak pointers stay live until then. Profiling builds
+// add that record's pointer to every control block and `RefCounted` object.
+//
+// `WriteHeapProfile` dumps the samples in the legacy gperftools heap format (`heap_v2`), which
+// `pprof` reads and scales back up to estimated totals.
+
+inline constexpr size_t kHeapSampleMaxDepth = 32;
+inline constexpr size_t kHeapProfileDefaultPeriod = size_t{512} << 10;
+
+struct HeapSample {
+    size_t bytes;
+    int depth;
+    void* stack[kHeapSampleMaxDepth];
+    // Links of the profiler's list of live samples
+    HeapSample* prev;
+    HeapSample* next;
+};
+
+class HeapProfiler {
+public:
+    // Never destroyed, so objects outliving static destruction may still drop their samples
+    static HeapProfiler& Instance();
+
+    // Mean number of bytes between samples; zero turns sampling off
+    void SetPeriod(size_t bytes);
+    // Counts `bytes` against the calling thread's distance to its next sample point
+    bool ShouldSample(size_t bytes);
+    // Takes the caller's stack
+    HeapSample* Record(size_t bytes);
+    void Release(HeapSample* sample);
+    void Write(std::ostream& out) const;
+
+private:
+    struct Totals {
+        size_t objects = 0;
+        size_t bytes = 0;
+    };
+
+    HeapProfiler();
+
+    static int64_t NextInterval(size_t period);
+
+    std::atomic<size_t> period_;
+    mutable std::mutex lock_;
+    HeapSample live_;  // Sentinel of the circular list of live samples
+    // All samples ever taken, for the allocation columns of the profile
+    std::map<std::vector<void*>, Totals> allocated_;
+};
+
+// Member through which an owner of memory holds the sample of its allocation, if it was taken
+class HeapSampleSlot {
+public:
+    HeapSampleSlot() = default;
+    // A copy is a different allocation, and not a sampled one
+    HeapSampleSlot(const HeapSampleSlot& other);
+    HeapSampleSlot& operator=(const HeapSampleSlot& other);
+    ~HeapSampleSlot();
+
+    void Sample(size_t bytes);
+    void Release();
+
+private:
+    HeapSample* sample_ = nullptr;
+};
+
+template <typename T, typename = void>
+struct HasHeapSampleSlot : std::false_type {};
+template <typename T>
+struct HasHeapSampleSlot<T, std::void_t<decltype(std::declval<T&>().HeapProfileSlot())>>
+    : std::true_type {};
+
+// Objects without a slot, such as intrusive types not built on `RefCounted`, are not profiled
+template <typename T>
+void SampleHeapAllocation(T* owner, size_t bytes) {
+    if constexpr (HasHeapSampleSlot<T>::value) {
+        owner->HeapProfileSlot().Sample(bytes);
+    }
+}
+
+inline void SetHeapProfilePeriod(size_t bytes) {
+    HeapProfiler::Instance().SetPeriod(bytes);
+}
+inline void WriteHeapProfile(std::ostream& out) {
+    HeapProfiler::Instance().Write(out);
+}
+
+inline HeapSampleSlot::HeapSampleSlot(const HeapSampleSlot&) {
+}
+inline HeapSampleSlot& HeapSampleSlot::operator=(const HeapSampleSlot&) {
+    return *this;
+}
+inline HeapSampleSlot::~HeapSampleSlot() {
+    Release();
+}
+inline void HeapSampleSlot::Sample(size_t bytes) {
+    HeapProfiler& profiler = HeapProfiler::Instance();
+    if (profiler.ShouldSample(bytes)) {
+        Release();
+        sample_ = profiler.Record(bytes);
+    }
+}
+inline void HeapSampleSlot::Release() {
+    if (sample_) {
+        HeapProfiler::Instance().Release(std::exchange(sample_, nullptr));
+    }
+}
+
+inline HeapProfiler& HeapProfiler::Instance() {
+    static HeapProfiler* profiler = new HeapProfiler();
+    return *profiler;
+}
+inline HeapProfiler::HeapProfiler() : period_(kHeapProfileDefaultPeriod) {
+    live_.prev = &live_;
+    live_.next = &live_;
+}
+inline void HeapProfiler::SetPeriod(size_t bytes) {
+    period_.store(bytes, std::memory_order_relaxed);
+}
+inline int64_t HeapProfiler::NextInterval(size_t period) {
+    // splitmix64, seeded per thread; the quality of `std::` engines is not needed here and their
+    // state is much larger
+    thread_local uint64_t state =
+        reinterpret_cast<uintptr_t>(&state) ^
+        static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    // Uniform in (0, 1], so the logarithm is finite
+    double uniform = (static_cast<double>(z >> 11) + 1) * 0x1.0p-53;
+    double interval = -std::log(uniform) * static_cast<double>(period);
+    if (interval < 1) {
+        return 1;
+    }
+    return interval < 0x1.0p62 ? static_cast<int64_t>(interval) : int64_t{1} << 62;
+}
+inline bool HeapProfiler::ShouldSample(size_t bytes) {
+    size_t period = period_.load(std::memory_order_relaxed);
+    if (period == 0) {
+        return false;
+    }
+    // Zero until the thread's first allocation draws its first interval
+    thread_local int64_t bytes_until_sample = 0;
+    if (bytes_until_sample == 0) {
+        bytes_until_sample = NextInterval(period);
+    }
+    bytes_until_sample -= static_cast<int64_t>(bytes);
+    if (bytes_until_sample > 0) {
+        return false;
+    }
+    bytes_until_sample = NextInterval(period);
+    return true;
+}
+__attribute__((noinline)) inline HeapSample* HeapProfiler::Record(size_t bytes) {
+    // Called right after the allocation it describes, so running out of memory loses the sample
+    // rather than the allocation
+    auto sample = new (std::nothrow) HeapSample();
+    if (!sample) {
+        return nullptr;
+    }
+    void* stack[kHeapSampleMaxDepth + 1];
+    int depth = backtrace(stack, static_cast<int>(kHeapSampleMaxDepth + 1));
+    // The first frame is this function
+    sample->depth = depth > 0 ? depth - 1 : 0;
+    std::copy(stack + 1, stack + 1 + sample->depth, sample->stack);
+    sample->bytes = bytes;
+
+    std::lock_guard guard(lock_);
+    try {
+        Totals& totals =
+            allocated_[std::vector<void*>(sample->stack, sample->stack + sample->depth)];
+        ++totals.objects;
+        totals.bytes += bytes;
+    } catch (const std::bad_alloc&) {
+        delete sample;
+        return nullptr;
+    }
+    sample->prev = live_.prev;
+    sample->next = &live_;
+    live_.prev->next = sample;
+    live_.prev = sample;
+    return sample;
+}
+inline void HeapProfiler::Release(HeapSample* sample) {
+    {
+        std::lock_guard guard(lock_);
+        sample->prev->next = sample->next;
+        sample->next->prev = sample->prev;
+    }
+    delete sample;
+}
+inline void HeapProfiler::Write(std::ostream& out) const {
+    std::map<std::vector<void*>, Totals> in_use;
+    std::vector<std::pair<std::vector<void*>, Totals>> allocated;
+    {
+        std::lock_guard guard(lock_);
+        for (const HeapSample* sample = live_.next; sample != &live_; sample = sample->next) {
+            Totals& totals = in_use[std::vector<void*>(sample->stack,
+                                                       sample->stack + sample->depth)];
+            ++totals.objects;
+            totals.bytes += sample->bytes;
+        }
+        allocated.assign(allocated_.begin(), allocated_.end());
+    }
+
+    Totals in_use_sum;
+    Totals allocated_sum;
+    for (const auto& [stack, totals] : allocated) {
+        Totals& live = in_use[stack];
+        in_use_sum.objects += live.objects;
+        in_use_sum.bytes += live.bytes;
+        allocated_sum.objects += totals.objects;
+        allocated_sum.bytes += totals.bytes;
+    }
+    char line[128];
+    auto write_counts = [&](const Totals& live, const Totals& all) {
+        std::snprintf(line, sizeof(line), "%6zu: %8zu [%6zu: %8zu] @", live.objects, live.bytes,
+                      all.objects, all.bytes);
+        out << line;
+    };
+    // `pprof` recognizes the format by this prefix, and scales the samples up by the period,
+    // which must not be zero
+    out << "heap profile: ";
+    write_counts(in_use_sum, allocated_sum);
+    out << " heap_v2/" << std::max<size_t>(period_.load(std::memory_order_relaxed), 1) << '\n';
+    for (const auto& [stack, totals] : allocated) {
+        write_counts(in_use[stack], totals);
+        for (void* frame : stack) {
+            auto address = reinterpret_cast<uintptr_t>(frame);
+            std::snprintf(line, sizeof(line), " 0x%016" PRIxPTR, address);
+            out << line;
+        }
+        out << '\n';
+    }
+
+    // Lets `pprof` map the addresses to binaries and symbolize them
+    out << "\nMAPPED_LIBRARIES:\n";
+    std::ifstream maps("/proc/self/maps");
+    if (maps) {
+        out << maps.rdbuf();
+    }
+}
@@ -0,0 +1,65 @@
+// Format check of `WriteHeapProfile` against what pprof's legacy heap parser matches. Not part of
+// any build; exits non-zero on the first failed check, and writes the dump to the path given as
+// its argument, for a parse by pprof itself:
+//     g++ -std=c++17 -O1 -g -DSMART_PTR_HEAP_PROFILE trace/heap_profile_test.cpp -o heap-test
+//     ./heap-test heap.prof && go tool pprof -raw heap-test heap.prof
+
+#include "../shared-from-this/shared.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define CHECK(condition)                                                                    \
+    do {                                                                                    \
+        if (!(condition)) {                                                                 \
+            std::fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #condition);   \
+            std::exit(1);                                                                   \
+        }                                                                                   \
+    } while (false)
+
+namespace {
+
+struct Block {
+    char bytes[1000];
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    SetHeapProfilePeriod(4096);
+    std::vector<SharedPtr<Block>> live;
+    for (int i = 0; i < 10000; ++i) {
+        SharedPtr<Block> block = MakeShared<Block>();
+        if (i % 2 == 0) {
+            live.push_back(block);
+        }
+    }
+
+    std::ostringstream out;
+    WriteHeapProfile(out);
+    std::istringstream profile(out.str());
+    std::string line;
+
+    // pprof's `heapHeaderRE` and `heapSampleRE`
+    std::getline(profile, line);
+    CHECK(std::regex_match(
+        line, std::regex(R"(heap profile: *\d+: *\d+ *\[ *\d+: *\d+ *\] *@ *heap_v2/\d+)")));
+    size_t samples = 0;
+    while (std::getline(profile, line) && !line.empty()) {
+        CHECK(std::regex_match(
+            line, std::regex(R"( *\d+: *\d+ *\[ *\d+: *\d+ *\] @( 0x[0-9a-f]+)+)")));
+        ++samples;
+    }
+    CHECK(samples > 0);
+    CHECK(std::getline(profile, line) && line == "MAPPED_LIBRARIES:");
+
+    if (argc > 1) {
+        std::ofstream(argv[1]) << out.str();
+    }
+    std::printf("ok\n");
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+// Instrumentation hooks of the pointer headers, each expanding to nothing unless its macro is
+// defined by the build:
+//     `SMART_PTR_TRACE_LIFETIMES`: lifetime tracing (`lifetime_trace.h`). `SMART_PTR_TRACE_DESTROY`
+//         times the rest of its scope, so it goes right before the code destroying the object, in
+//         a scope of its own.
+//     `SMART_PTR_HEAP_PROFILE`: heap profiling (`heap_profile.h`). `SMART_PTR_HEAP_SAMPLE` goes
+//         right after an allocation, with the object that will own its sample.
+#ifdef SMART_PTR_TRACE_LIFETIMES
+#include "lifetime_trace.h"
+
+#define SMART_PTR_TRACE_CREATE(object) TraceLifetimeCreate(object)
+#define SMART_PTR_TRACE_DESTROY(object) LifetimeTraceScope lifetime_trace_scope(object)
+#else
+#define SMART_PTR_TRACE_CREATE(object) static_cast<void>(0)
+#define SMART_PTR_TRACE_DESTROY(object) static_cast<void>(0)
+#endif
+
+#ifdef SMART_PTR_HEAP_PROFILE
+#include "heap_profile.h"
+
+#define SMART_PTR_HEAP_SAMPLE(owner, bytes) SampleHeapAllocation(owner, bytes)
+#else
+#define SMART_PTR_HEAP_SAMPLE(owner, bytes) static_cast<void>(0)
+#endif
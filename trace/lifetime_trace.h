@@ -0,0 +1,348 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <unistd.h>
+
+// Tracer of object lifetimes, compiled into the pointer headers only when
+// `SMART_PTR_TRACE_LIFETIMES` is defined (see `hooks.h`). Every sampled object gets a creation
+// event and a destruction event timing its destructor plus deallocation, each with the type, the
+// size and the thread; `WriteLifetimeTrace` exports them as Chrome trace JSON, which both
+// `chrome://tracing` and Perfetto open. `UniquePtr` and `IntrusivePtr` record creations in
+// `MakeUnique` and `MakeIntrusive` only, so objects they adopt from raw pointers show just their
+// destruction.
+//
+// Events go to per-thread rings, so recording is a few relaxed stores and two clock reads with no
+// locks or shared cache lines; a ring keeps the latest `kLifetimeTraceRingSize` events of its
+// thread. Sampling is by object address, so an object is either traced at both ends or not at
+// all, and one that is not costs a multiply and a compare.
+//
+// The tracer sits below the pointer types and must not use them: it would trace itself.
+
+inline constexpr size_t kLifetimeTraceRingSize = 8192;
+inline constexpr uint32_t kLifetimeTraceDefaultSampling = 64;
+
+enum class LifetimeEventKind : uint8_t { kCreate, kDestroy };
+
+class LifetimeTracer {
+public:
+    // Never destroyed, so objects outliving static destruction may still report
+    static LifetimeTracer& Instance();
+
+    // One object in `one_in`, rounded up to a power of two, is traced; zero turns tracing off
+    void SetSampling(uint32_t one_in);
+    bool IsSampled(const void* object) const;
+    uint64_t Now() const;
+
+    void Record(LifetimeEventKind kind, const char* type, size_t size, const void* object,
+                uint64_t start, uint64_t duration);
+    // Events of threads still running may be missed if they overwrite them meanwhile
+    void Write(std::ostream& out) const;
+    void Clear();
+
+private:
+    struct Event {
+        // Seqlock: odd while the slot is being written, `2 * index + 2` once event `index` is in
+        std::atomic<uint64_t> sequence{0};
+        std::atomic<const char*> type{nullptr};
+        std::atomic<const void*> object{nullptr};
+        std::atomic<uint64_t> size{0};
+        std::atomic<uint64_t> start{0};
+        std::atomic<uint64_t> duration{0};
+        std::atomic<uint64_t> kind_and_thread{0};
+    };
+    struct Ring {
+        Event events[kLifetimeTraceRingSize];
+        std::atomic<uint64_t> head{0};
+        std::atomic<bool> in_use{false};
+    };
+    struct Holder {
+        ~Holder();
+
+        Ring* ring = nullptr;
+        uint32_t thread = 0;
+        bool* destroyed = nullptr;
+    };
+
+    LifetimeTracer();
+
+    // Null on a thread whose thread-local state is already gone
+    Holder* ThreadHolder();
+    Ring* AcquireRing();
+
+    std::chrono::steady_clock::time_point epoch_;
+    // Objects whose hash has none of these bits set are traced
+    std::atomic<uint64_t> sample_mask_;
+    std::atomic<uint32_t> next_thread_;
+    mutable std::mutex rings_lock_;
+    // Rings of exited threads are handed to new ones; their events stay until overwritten
+    std::vector<std::unique_ptr<Ring>> rings_;
+};
+
+// Readable name of `T`, taken from the compiler's signature of this function
+template <typename T>
+const char* LifetimeTypeName() {
+    static const std::string* name = [](std::string_view signature) {
+        size_t begin = signature.find("T = ");
+        if (begin == std::string_view::npos) {
+            return new std::string(signature);
+        }
+        begin += 4;
+        size_t end = signature.find_first_of(";]", begin);
+        return new std::string(signature.substr(begin, end - begin));
+    }(__PRETTY_FUNCTION__);
+    return name->c_str();
+}
+
+// Key of an object in the trace: the address of its most derived object, so the events of an
+// object seen through pointers to different bases match
+template <typename T>
+const void* LifetimeTraceKey(const T* object) {
+    if constexpr (std::is_polymorphic_v<T>) {
+        return dynamic_cast<const void*>(object);
+    } else {
+        return object;
+    }
+}
+
+template <typename T>
+void TraceLifetimeCreate(const T* object) {
+    LifetimeTracer& tracer = LifetimeTracer::Instance();
+    const void* key = LifetimeTraceKey(object);
+    if (tracer.IsSampled(key)) {
+        tracer.Record(LifetimeEventKind::kCreate, LifetimeTypeName<T>(), sizeof(T), key,
+                      tracer.Now(), 0);
+    }
+}
+
+// Times the rest of the enclosing scope as the destruction of `object`, which is only used as a
+// key and never dereferenced
+class LifetimeTraceScope {
+public:
+    template <typename T>
+    explicit LifetimeTraceScope(const T* object)
+        : type_(nullptr), size_(sizeof(T)), object_(LifetimeTraceKey(object)), start_(0) {
+        LifetimeTracer& tracer = LifetimeTracer::Instance();
+        if (tracer.IsSampled(object_)) {
+            type_ = LifetimeTypeName<T>();
+            start_ = tracer.Now();
+        }
+    }
+    LifetimeTraceScope(const LifetimeTraceScope& other) = delete;
+    LifetimeTraceScope& operator=(const LifetimeTraceScope& other) = delete;
+    ~LifetimeTraceScope();
+
+private:
+    const char* type_;  // Null if not sampled
+    size_t size_;
+    const void* object_;
+    uint64_t start_;
+};
+
+inline void SetLifetimeTraceSampling(uint32_t one_in) {
+    LifetimeTracer::Instance().SetSampling(one_in);
+}
+inline void WriteLifetimeTrace(std::ostream& out) {
+    LifetimeTracer::Instance().Write(out);
+}
+inline void ClearLifetimeTrace() {
+    LifetimeTracer::Instance().Clear();
+}
+
+inline LifetimeTraceScope::~LifetimeTraceScope() {
+    if (type_) {
+        LifetimeTracer& tracer = LifetimeTracer::Instance();
+        tracer.Record(LifetimeEventKind::kDestroy, type_, size_, object_, start_,
+                      tracer.Now() - start_);
+    }
+}
+
+inline LifetimeTracer& LifetimeTracer::Instance() {
+    static LifetimeTracer* tracer = new LifetimeTracer();
+    return *tracer;
+}
+inline LifetimeTracer::LifetimeTracer()
+    : epoch_(std::chrono::steady_clock::now()),
+      sample_mask_(0),
+      next_thread_(1) {
+    SetSampling(kLifetimeTraceDefaultSampling);
+}
+inline void LifetimeTracer::SetSampling(uint32_t one_in) {
+    uint64_t mask = ~uint64_t{0};
+    if (one_in) {
+        mask = 0;
+        while (mask + 1 < one_in) {
+            mask = mask << 1 | 1;
+        }
+    }
+    sample_mask_.store(mask, std::memory_order_relaxed);
+}
+inline bool LifetimeTracer::IsSampled(const void* object) const {
+    // Allocations are aligned, so the low bits carry nothing; the product's top half mixes all
+    // of the rest. Bit 32 is only covered by the mask that turns tracing off.
+    uint64_t hash = (reinterpret_cast<uintptr_t>(object) >> 4) * 0x9e3779b97f4a7c15ULL;
+    hash = hash >> 32 | uint64_t{1} << 32;
+    return (hash & sample_mask_.load(std::memory_order_relaxed)) == 0;
+}
+inline uint64_t LifetimeTracer::Now() const {
+    auto elapsed = std::chrono::steady_clock::now() - epoch_;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+}
+inline LifetimeTracer::Holder::~Holder() {
+    if (ring) {
+        ring->in_use.store(false, std::memory_order_release);
+    }
+    *destroyed = true;
+}
+inline LifetimeTracer::Holder* LifetimeTracer::ThreadHolder() {
+    // Objects destroyed by later thread-local destructors go untraced
+    thread_local bool destroyed = false;
+    if (destroyed) {
+        return nullptr;
+    }
+    thread_local Holder holder;
+    if (!holder.destroyed) {
+        holder.destroyed = &destroyed;
+        holder.thread = next_thread_.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (!holder.ring) {
+        holder.ring = AcquireRing();
+    }
+    return &holder;
+}
+inline LifetimeTracer::Ring* LifetimeTracer::AcquireRing() {
+    std::lock_guard guard(rings_lock_);
+    for (auto& ring : rings_) {
+        if (!ring->in_use.load(std::memory_order_acquire)) {
+            ring->in_use.store(true, std::memory_order_relaxed);
+            return ring.get();
+        }
+    }
+    // Called from destructors, so running out of memory drops the event rather than throwing
+    try {
+        rings_.push_back(std::make_unique<Ring>());
+    } catch (const std::bad_alloc&) {
+        return nullptr;
+    }
+    rings_.back()->in_use.store(true, std::memory_order_relaxed);
+    return rings_.back().get();
+}
+inline void LifetimeTracer::Record(LifetimeEventKind kind, const char* type, size_t size,
+                                   const void* object, uint64_t start, uint64_t duration) {
+    Holder* holder = ThreadHolder();
+    if (!holder || !holder->ring) {
+        return;
+    }
+    Ring& ring = *holder->ring;
+    uint64_t index = ring.head.load(std::memory_order_relaxed);
+    Event& event = ring.events[index % kLifetimeTraceRingSize];
+    event.sequence.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    event.type.store(type, std::memory_order_relaxed);
+    event.object.store(object, std::memory_order_relaxed);
+    event.size.store(size, std::memory_order_relaxed);
+    event.start.store(start, std::memory_order_relaxed);
+    event.duration.store(duration, std::memory_order_relaxed);
+    event.kind_and_thread.store(static_cast<uint64_t>(kind) << 32 | holder->thread,
+                                std::memory_order_relaxed);
+    event.sequence.store(2 * index + 2, std::memory_order_release);
+    ring.head.store(index + 1, std::memory_order_release);
+}
+inline void LifetimeTracer::Clear() {
+    std::lock_guard guard(rings_lock_);
+    for (auto& ring : rings_) {
+        // Invalidates the sequences of every event written so far, without touching the head
+        // that the owning thread keeps writing at
+        for (Event& event : ring->events) {
+            event.sequence.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+inline void LifetimeTracer::Write(std::ostream& out) const {
+    // Timestamps are in microseconds, with nanoseconds as the fraction
+    auto write_time = [&out](const char* key, uint64_t nanoseconds) {
+        char buffer[48];
+        std::snprintf(buffer, sizeof(buffer), ",\"%s\":%llu.%03llu", key,
+                      static_cast<unsigned long long>(nanoseconds / 1000),
+                      static_cast<unsigned long long>(nanoseconds % 1000));
+        out << buffer;
+    };
+    auto write_string = [&out](const char* string) {
+        out << '"';
+        for (const char* c = string; *c; ++c) {
+            if (*c == '"' || *c == '\\') {
+                out << '\\';
+            }
+            out << *c;
+        }
+        out << '"';
+    };
+    long pid = static_cast<long>(getpid());
+    std::vector<uint32_t> threads;
+    bool first = true;
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+    std::lock_guard guard(rings_lock_);
+    for (const auto& ring : rings_) {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t begin = head > kLifetimeTraceRingSize ? head - kLifetimeTraceRingSize : 0;
+        for (uint64_t index = begin; index < head; ++index) {
+            const Event& event = ring->events[index % kLifetimeTraceRingSize];
+            uint64_t sequence = event.sequence.load(std::memory_order_acquire);
+            if (sequence != 2 * index + 2) {
+                continue;
+            }
+            const char* type = event.type.load(std::memory_order_relaxed);
+            const void* object = event.object.load(std::memory_order_relaxed);
+            uint64_t size = event.size.load(std::memory_order_relaxed);
+            uint64_t start = event.start.load(std::memory_order_relaxed);
+            uint64_t duration = event.duration.load(std::memory_order_relaxed);
+            uint64_t kind_and_thread = event.kind_and_thread.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (event.sequence.load(std::memory_order_relaxed) != sequence) {
+                continue;  // Overwritten while being read
+            }
+            auto kind = static_cast<LifetimeEventKind>(kind_and_thread >> 32);
+            auto thread = static_cast<uint32_t>(kind_and_thread);
+            if (threads.empty() || threads.back() != thread) {
+                threads.push_back(thread);
+            }
+
+            out << (first ? "" : ",") << "\n{\"name\":";
+            first = false;
+            write_string(type);
+            if (kind == LifetimeEventKind::kCreate) {
+                out << ",\"cat\":\"create\",\"ph\":\"i\",\"s\":\"t\"";
+                write_time("ts", start);
+            } else {
+                out << ",\"cat\":\"destroy\",\"ph\":\"X\"";
+                write_time("ts", start);
+                write_time("dur", duration);
+            }
+            out << ",\"pid\":" << pid << ",\"tid\":" << thread << ",\"args\":{\"size\":" << size
+                << ",\"object\":\"" << object << "\"}}";
+        }
+    }
+
+    std::sort(threads.begin(), threads.end());
+    threads.erase(std::unique(threads.begin(), threads.end()), threads.end());
+    for (uint32_t thread : threads) {
+        out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+            << ",\"tid\":" << thread << ",\"args\":{\"name\":\"thread " << thread << "\"}}";
+        first = false;
+    }
+    out << "\n]}\n";
+}
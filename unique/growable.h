@@ -0,0 +1,275 @@
+#pragma once
+
+#include "unique.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>  // std::max
+#include <cstdint>
+#include <cstdlib>  // std::malloc, std::realloc, std::free
+#include <cstring>  // std::memcpy
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+// Buffers of relocatable elements this large are moved from the heap to their own mapping,
+// which later grows with `mremap` and never gets copied again
+inline constexpr size_t kGrowableMmapThreshold = size_t{1} << 20;
+
+enum class GrowableStorage : uint8_t { kNone, kHeap, kMalloc, kMapped };
+
+// Elements that may be moved with `memcpy`, and whose alignment `malloc` honours
+template <typename T>
+inline constexpr bool kIsGrowableRelocatable =
+    std::is_trivially_copyable_v<T> && alignof(T) <= alignof(std::max_align_t);
+
+// Deleter of a `GrowableArray`'s buffer: knows how many elements are alive and where the
+// buffer came from
+template <typename T>
+struct GrowableDeleter {
+    void operator()(T* ptr) const;
+
+    size_t size = 0;
+    size_t capacity = 0;
+    GrowableStorage storage = GrowableStorage::kNone;
+};
+template <typename T>
+void GrowableDeleter<T>::operator()(T* ptr) const {
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+        for (size_t i = size; i > 0; --i) {
+            ptr[i - 1].~T();
+        }
+    }
+    switch (storage) {
+        case GrowableStorage::kHeap:
+            ::operator delete(ptr, std::align_val_t(alignof(T)));
+            break;
+        case GrowableStorage::kMalloc:
+            std::free(ptr);
+            break;
+        case GrowableStorage::kMapped:
+            munmap(ptr, capacity * sizeof(T));
+            break;
+        case GrowableStorage::kNone:
+            break;
+    }
+}
+
+// `UniquePtr<T[]>` that remembers its length and can grow. For relocatable `T` the buffer grows
+// in place when it can: with `realloc` while small, with `mremap` once it has its own mapping.
+// Other types are move-constructed into a new buffer (copied if their move may throw).
+template <typename T>
+class GrowableArray {
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    GrowableArray();
+    // `size` value-initialized elements
+    explicit GrowableArray(size_t size);
+
+    GrowableArray(GrowableArray&& other) noexcept;
+    GrowableArray(const GrowableArray& other) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    GrowableArray& operator=(GrowableArray&& other) noexcept;
+    GrowableArray& operator=(const GrowableArray& other) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    // Appends value-initialized elements up to `size`; no-op if there are that many already.
+    // Capacity at least doubles, so growing one element at a time is amortized O(1).
+    // Both throw `std::length_error` past `MaxSize()`.
+    void Grow(size_t size);
+    void Reserve(size_t capacity);
+    void Reset();
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T* Get() const;
+    T& operator[](size_t ind);
+    const T& operator[](size_t ind) const;
+    size_t Size() const;
+    size_t Capacity() const;
+    GrowableStorage Storage() const;
+    // Largest capacity whose byte size, rounded up to whole pages, fits in `size_t`
+    static size_t MaxSize();
+
+private:
+    static size_t PageSize();
+    // Capacity that fills whole pages, for mapped buffers
+    static size_t RoundToPages(size_t capacity);
+    void Relocate(size_t capacity);
+    void Reallocate(size_t capacity);
+
+    UniquePtr<T[], GrowableDeleter<T>> data_;
+};
+template <typename T>
+GrowableArray<T>::GrowableArray() : data_(nullptr) {
+}
+template <typename T>
+GrowableArray<T>::GrowableArray(size_t size) : data_(nullptr) {
+    Grow(size);
+}
+template <typename T>
+GrowableArray<T>::GrowableArray(GrowableArray&& other) noexcept : data_(std::move(other.data_)) {
+    other.data_.GetDeleter() = GrowableDeleter<T>();
+}
+template <typename T>
+GrowableArray<T>& GrowableArray<T>::operator=(GrowableArray&& other) noexcept {
+    if (&other == this) {
+        return *this;
+    }
+    data_ = std::move(other.data_);
+    other.data_.GetDeleter() = GrowableDeleter<T>();
+    return *this;
+}
+template <typename T>
+size_t GrowableArray<T>::PageSize() {
+    static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return page_size;
+}
+template <typename T>
+size_t GrowableArray<T>::MaxSize() {
+    return (SIZE_MAX - PageSize()) / sizeof(T);
+}
+template <typename T>
+size_t GrowableArray<T>::RoundToPages(size_t capacity) {
+    size_t bytes = (capacity * sizeof(T) + PageSize() - 1) / PageSize() * PageSize();
+    return bytes / sizeof(T);
+}
+template <typename T>
+void GrowableArray<T>::Grow(size_t size) {
+    GrowableDeleter<T>& state = data_.GetDeleter();
+    if (size <= state.size) {
+        return;
+    }
+    if (size > state.capacity) {
+        size_t max_size = MaxSize();
+        if (size > max_size) {
+            throw std::length_error("GrowableArray size too large");
+        }
+        // Doubling stops at the limit rather than wrapping around
+        Reserve(std::max(size, state.capacity > max_size / 2 ? max_size : state.capacity * 2));
+    }
+    T* data = data_.Get();
+    // `state.size` is bumped per element, so a throwing constructor leaves a consistent array
+    for (; state.size < size; ++state.size) {
+        new (data + state.size) T();
+    }
+}
+template <typename T>
+void GrowableArray<T>::Reserve(size_t capacity) {
+    if (capacity <= data_.GetDeleter().capacity) {
+        return;
+    }
+    if (capacity > MaxSize()) {
+        throw std::length_error("GrowableArray size too large");
+    }
+    if constexpr (kIsGrowableRelocatable<T>) {
+        Relocate(capacity);
+    } else {
+        Reallocate(capacity);
+    }
+}
+template <typename T>
+void GrowableArray<T>::Relocate(size_t capacity) {
+    GrowableDeleter<T> state = data_.GetDeleter();
+    T* old_data = data_.Release();
+    T* data = nullptr;
+    if (capacity * sizeof(T) >= kGrowableMmapThreshold) {
+        capacity = RoundToPages(capacity);
+        void* mapped = MAP_FAILED;
+        if (state.storage == GrowableStorage::kMapped) {
+#ifdef MREMAP_MAYMOVE
+            mapped = mremap(old_data, state.capacity * sizeof(T), capacity * sizeof(T),
+                            MREMAP_MAYMOVE);
+#else
+            mapped = mmap(nullptr, capacity * sizeof(T), PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mapped != MAP_FAILED) {
+                std::memcpy(mapped, old_data, state.size * sizeof(T));
+                munmap(old_data, state.capacity * sizeof(T));
+            }
+#endif
+        } else {
+            mapped = mmap(nullptr, capacity * sizeof(T), PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mapped != MAP_FAILED && old_data) {
+                std::memcpy(mapped, old_data, state.size * sizeof(T));
+                std::free(old_data);
+            }
+        }
+        if (mapped == MAP_FAILED) {
+            data_.Reset(old_data);
+            throw std::bad_alloc();
+        }
+        data = static_cast<T*>(mapped);
+        state.storage = GrowableStorage::kMapped;
+    } else {
+        data = static_cast<T*>(std::realloc(old_data, capacity * sizeof(T)));
+        if (!data) {
+            data_.Reset(old_data);
+            throw std::bad_alloc();
+        }
+        state.storage = GrowableStorage::kMalloc;
+    }
+    state.capacity = capacity;
+    data_.GetDeleter() = state;
+    data_.Reset(data);
+}
+template <typename T>
+void GrowableArray<T>::Reallocate(size_t capacity) {
+    GrowableDeleter<T> state = data_.GetDeleter();
+    auto data = static_cast<T*>(::operator new(capacity * sizeof(T), std::align_val_t(alignof(T))));
+    T* old_data = data_.Get();
+    size_t moved = 0;
+    try {
+        for (; moved < state.size; ++moved) {
+            new (data + moved) T(std::move_if_noexcept(old_data[moved]));
+        }
+    } catch (...) {
+        GrowableDeleter<T>{moved, capacity, GrowableStorage::kHeap}(data);
+        throw;
+    }
+    data_.Reset();
+    state.capacity = capacity;
+    state.storage = GrowableStorage::kHeap;
+    data_.GetDeleter() = state;
+    data_.Reset(data);
+}
+template <typename T>
+void GrowableArray<T>::Reset() {
+    data_.Reset();
+    data_.GetDeleter() = GrowableDeleter<T>();
+}
+template <typename T>
+T* GrowableArray<T>::Get() const {
+    return data_.Get();
+}
+template <typename T>
+T& GrowableArray<T>::operator[](size_t ind) {
+    return data_[ind];
+}
+template <typename T>
+const T& GrowableArray<T>::operator[](size_t ind) const {
+    return data_[ind];
+}
+template <typename T>
+size_t GrowableArray<T>::Size() const {
+    return data_.GetDeleter().size;
+}
+template <typename T>
+size_t GrowableArray<T>::Capacity() const {
+    return data_.GetDeleter().capacity;
+}
+template <typename T>
+GrowableStorage GrowableArray<T>::Storage() const {
+    return data_.GetDeleter().storage;
+}
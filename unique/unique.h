@@ -1,16 +1,22 @@
 #pragma once
 
 #include "compressed_pair.h"
+#include "../trace/hooks.h"
 // #include <utility>
 
 #include <cstddef>  // std::nullptr_t
+#include <cstdint>  // SIZE_MAX
+#include <cstdlib>  // std::aligned_alloc, std::free
+#include <new>      // std::bad_alloc, std::bad_array_new_length
+#include <stdexcept>
+#include <type_traits>
 #include "common/my_int.h"
 
 template <typename T>
 struct DefaultDeleter {
     DefaultDeleter() = default;
     template <typename U>
-    DefaultDeleter(const DefaultDeleter<U>& other) {
+    DefaultDeleter(const DefaultDeleter<U>&) {
     }
     void operator()(T* ptr) const {
         delete ptr;
@@ -20,7 +26,7 @@ template <typename T>
 struct DefaultDeleter<T[]> {
     DefaultDeleter() = default;
     template <typename U>
-    DefaultDeleter(const DefaultDeleter<U>& other) {
+    DefaultDeleter(const DefaultDeleter<U>&) {
     }
     void operator()(T* ptr) const {
         delete[] ptr;
@@ -123,6 +129,7 @@ UniquePtr<T, Deleter>::UniquePtr(UniquePtr<U, E>&& other) {
 template <typename T, typename Deleter>
 void UniquePtr<T, Deleter>::Clear() {
     if (data_.First()) {
+        SMART_PTR_TRACE_DESTROY(data_.First());
         data_.Second().operator()(data_.First());
     }
     data_.First() = nullptr;
@@ -168,6 +175,7 @@ void UniquePtr<T, Deleter>::Reset(T* ptr) {
     T* old_ptr = data_.First();
     data_.First() = ptr;
     if (old_ptr) {
+        SMART_PTR_TRACE_DESTROY(old_ptr);
         data_.Second().operator()(old_ptr);
     }
 }
@@ -549,3 +557,125 @@ template <typename Deleter>
 UniquePtr<void, Deleter>::operator bool() const {
     return data_.First() != nullptr;
 }
+
+// Deleter of the result of a cast to `T*`: `DefaultDeleter`s are rebound to `T`, so upcasts and
+// const-adding casts work as for plain pointers; any other deleter moves over unchanged
+template <typename E, typename T>
+struct UniqueCastDeleter {
+    using Type = E;
+};
+template <typename Y, typename T>
+struct UniqueCastDeleter<DefaultDeleter<Y>, T> {
+    using Type = DefaultDeleter<T>;
+};
+template <typename E, typename T>
+using UniqueCastDeleterT = typename UniqueCastDeleter<E, T>::Type;
+
+// Ownership moves with the cast, and so does the deleter. A custom one keeps deleting through
+// the type it was made for, so it has to accept the cast pointer: with such deleters only
+// downcasts (and const removal) compile. A failed `DynamicPointerCast` leaves `ptr` as it was.
+template <typename T, typename Y, typename E>
+UniquePtr<T, UniqueCastDeleterT<E, T>> StaticPointerCast(UniquePtr<Y, E>&& ptr) {
+    using Deleter = UniqueCastDeleterT<E, T>;
+    static_assert(std::is_invocable_v<Deleter&, T*>,
+                  "the deleter does not accept the cast pointer: custom deleters only support "
+                  "downcasts");
+    T* cast = static_cast<T*>(ptr.Get());
+    Deleter deleter(std::move(ptr.GetDeleter()));
+    ptr.Release();
+    return UniquePtr<T, Deleter>(cast, std::move(deleter));
+}
+template <typename T, typename Y, typename E>
+UniquePtr<T, UniqueCastDeleterT<E, T>> DynamicPointerCast(UniquePtr<Y, E>&& ptr) {
+    using Deleter = UniqueCastDeleterT<E, T>;
+    static_assert(std::is_invocable_v<Deleter&, T*>,
+                  "the deleter does not accept the cast pointer: custom deleters only support "
+                  "downcasts");
+    T* cast = dynamic_cast<T*>(ptr.Get());
+    if (!cast) {
+        return UniquePtr<T, Deleter>();
+    }
+    Deleter deleter(std::move(ptr.GetDeleter()));
+    ptr.Release();
+    return UniquePtr<T, Deleter>(cast, std::move(deleter));
+}
+template <typename T, typename Y, typename E>
+UniquePtr<T, UniqueCastDeleterT<E, T>> ConstPointerCast(UniquePtr<Y, E>&& ptr) {
+    using Deleter = UniqueCastDeleterT<E, T>;
+    static_assert(std::is_invocable_v<Deleter&, T*>,
+                  "the deleter does not accept the cast pointer: custom deleters only support "
+                  "removing const");
+    T* cast = const_cast<T*>(ptr.Get());
+    Deleter deleter(std::move(ptr.GetDeleter()));
+    ptr.Release();
+    return UniquePtr<T, Deleter>(cast, std::move(deleter));
+}
+
+template <typename T, typename... Args>
+std::enable_if_t<!std::is_array_v<T>, UniquePtr<T>> MakeUnique(Args&&... args) {
+    // Creation is traced here, where the object is allocated: the constructors from raw pointers
+    // also take objects back from `Release` and casts
+    T* ptr = new T{std::forward<Args>(args)...};
+    SMART_PTR_TRACE_CREATE(ptr);
+    return UniquePtr<T>(ptr);
+}
+
+template <typename T>
+std::enable_if_t<std::is_array_v<T> && std::extent_v<T> == 0, UniquePtr<T>> MakeUnique(
+    size_t size) {
+    return UniquePtr<T>(new std::remove_extent_t<T>[size]());
+}
+
+// Deleter for arrays from `MakeUniqueAligned`: destroys the elements (it has to remember how
+// many there are for that) and returns the memory to `std::aligned_alloc`'s heap
+template <typename T>
+struct AlignedDeleter;
+template <typename T>
+struct AlignedDeleter<T[]> {
+    AlignedDeleter() : size(0) {
+    }
+    explicit AlignedDeleter(size_t size) : size(size) {
+    }
+    void operator()(T* ptr) const {
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            for (size_t i = size; i > 0; --i) {
+                ptr[i - 1].~T();
+            }
+        }
+        std::free(ptr);
+    }
+
+    size_t size;
+};
+
+// Value-initialized array of `size` elements whose first element is aligned to `alignment`
+// (a power of two, at least `alignof(T)`); the default of 64 bytes fits one AVX-512 register
+// and one cache line, so vectorized loops need no peeling.
+template <typename T>
+std::enable_if_t<std::is_array_v<T> && std::extent_v<T> == 0,
+                 UniquePtr<T, AlignedDeleter<T>>>
+MakeUniqueAligned(size_t size, size_t alignment = 64) {
+    using Element = std::remove_extent_t<T>;
+    if (alignment < alignof(Element) || (alignment & (alignment - 1)) != 0) {
+        throw std::invalid_argument("alignment must be a power of two not below alignof(T)");
+    }
+    if (size > (SIZE_MAX - alignment) / sizeof(Element)) {
+        throw std::bad_array_new_length();
+    }
+    // `std::aligned_alloc` wants the size to be a multiple of the alignment
+    size_t bytes = (size * sizeof(Element) + alignment - 1) / alignment * alignment;
+    auto data = static_cast<Element*>(std::aligned_alloc(alignment, bytes ? bytes : alignment));
+    if (!data) {
+        throw std::bad_alloc();
+    }
+    size_t constructed = 0;
+    try {
+        for (; constructed < size; ++constructed) {
+            new (data + constructed) Element();
+        }
+    } catch (...) {
+        AlignedDeleter<T>{constructed}(data);
+        throw;
+    }
+    return UniquePtr<T, AlignedDeleter<T>>(data, AlignedDeleter<T>(size));
+}